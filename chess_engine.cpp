@@ -1,20 +1,149 @@
 #include <algorithm>
 #include <climits>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <iomanip>
 #include <cctype>
 #include <vector>
+#include <chrono>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <charconv>
+#include <memory>
+#include <fstream>
+#include <functional>
+#include <unordered_set>
+#include <random>
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(PERF_COUNTERS) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#endif
+
+std::mutex io_mutex; // held while writing a line to std::cout, since the search thread and the UCI thread both print
 
-int illegal = 0, legal = 0;
+/**
+ * Leveled logger to std::clog. Messages are buffered and only written by flush() at protocol boundaries (bestmove, readyok, end of a console turn).
+ * LOG_COMPILED_LEVEL (e.g. /DLOG_COMPILED_LEVEL=0) removes the more verbose levels at compile time, Logger::level filters at runtime (UCI option LogLevel).
+ */
+enum LogLevel: int {
+    LOG_ERROR = 0, LOG_WARN = 1, LOG_INFO = 2, LOG_DEBUG = 3,
+    MAX_LOG_LEVEL = 4
+};
+const char *const LOG_LEVEL_NAMES[MAX_LOG_LEVEL] = { "error", "warn", "info", "debug" };
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_DEBUG
+#endif
+
+struct Logger
+{
+    std::atomic<int> level{LOG_INFO};
+    std::mutex mutex;
+    std::string buffer = "";
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!buffer.empty())
+        {
+            std::clog << buffer << std::flush;
+            buffer.clear();
+        }
+    }
+} logger;
+
+#define LOG(level_, message) \
+    do \
+    { \
+        if ((level_) <= LOG_COMPILED_LEVEL && (level_) <= logger.level.load(std::memory_order_relaxed)) \
+        { \
+            std::ostringstream log_line; \
+            log_line << '[' << LOG_LEVEL_NAMES[level_] << "] " << message << '\n'; \
+            std::lock_guard<std::mutex> log_lock(logger.mutex); \
+            logger.buffer += log_line.str(); \
+        } \
+    } \
+    while (false)
 
 const std::string DEFAULT_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
 const short MAX_DEPTH = 7,
-            NM_R = 3,
-            NM_DEPTH_INC = NM_R + 1,
-            MAX_NM_DEPTH = MAX_DEPTH - NM_DEPTH_INC,
-            MAX_VCTM_CNT = 26;
+            MAX_EXT_CNT = 4, // max number of check extensions along one line
+            MAX_PLY = MAX_DEPTH + MAX_EXT_CNT,
+            MAX_VCTM_CNT = 26,
+            MAX_MULTI_PV = 256;
+
+/**
+ * Tunable search parameters, one copy per Engine so that engines in one process (e.g. of a match) can differ.
+ * Defaults and ranges are in PARAMS.
+ */
+struct SearchParams
+{
+    short NM_R; // depth reduction of the Null-Move search
+    short IID_R; // depth reduction of the Internal Iterative Deepening search
+    short IID_PV_DRAFT, IID_CUT_DRAFT; // min remaining depth for Internal Iterative Deepening at PV / other nodes
+    short EXT_CNT; // max number of check extensions along one line
+
+    SearchParams();
+};
+
+/**
+ * Registry of SearchParams: UCI options of the same name, match/epd/batch options ("NM_R 2") and what SPSA tunes.
+ */
+struct Param
+{
+    const char *name;
+    short SearchParams::*value;
+    short default_value, min, max;
+    double step; // SPSA perturbation at the end of tuning
+};
+const Param PARAMS[] = {
+    {"NM_R", &SearchParams::NM_R, 3, 1, 5, 0.5},
+    {"IID_R", &SearchParams::IID_R, 2, 1, 3, 0.5},
+    {"IID_PV_DRAFT", &SearchParams::IID_PV_DRAFT, 4, 3, 7, 0.5}, // min must be >= max of IID_R
+    {"IID_CUT_DRAFT", &SearchParams::IID_CUT_DRAFT, 5, 3, 7, 0.5},
+    {"EXT_CNT", &SearchParams::EXT_CNT, MAX_EXT_CNT, 0, MAX_EXT_CNT, 0.5},
+};
+
+SearchParams::SearchParams()
+{
+    for (const Param &param : PARAMS)
+        this->*param.value = param.default_value;
+}
+
+/**
+ * @return PARAMS entry named name, nullptr if none.
+ */
+inline const Param *param_of(std::string_view name)
+{
+    for (const Param &param : PARAMS)
+        if (name == param.name)
+            return &param;
+    return nullptr;
+}
 
 enum Player: short {
     BOT = 0, HUMAN = 1,
@@ -73,7 +202,20 @@ const short PLAY_WIDTH = 8,
 unsigned long long ZTABLE[MAX_PLAYER][MAX_SHAPE][AREA] = {{{74029666500212977ULL,8088122161323000979ULL,16521829690994476282ULL,10814004662382438494ULL,9052198920789078554ULL,7381380909356947872ULL,10961594741481288303ULL,12502116868085730778ULL,0,0,16285795259516428329ULL,6715870808026712034ULL,528819992478005418ULL,2284534088986354339ULL,10169200759946765890ULL,3813019469742317492ULL,10592760183762258614ULL,7367238674766648970ULL,0,0,8217673022687244206ULL,3185531743396549562ULL,4800618912728694941ULL,13001216913356387140ULL,1176407869339060974ULL,4150604921837518705ULL,15145879036230750153ULL,994800405537611429ULL,0,0,14929242313517210031ULL,3154703689421785657ULL,13657994561754603932ULL,6249946986953333237ULL,1660217323733090078ULL,14005543184922861485ULL,16585001373474024155ULL,1666516127252300525ULL,0,0,2520622342062774609ULL,9082651322321000509ULL,15707617857353975308ULL,12331560545761409745ULL,6406546869475516057ULL,14097720597159422151ULL,105262242311684541ULL,8294782069855283264ULL,0,0,4633297685661641163ULL,6612006991566468995ULL,8580220009698662865ULL,8532728303557126422ULL,10445062476084314952ULL,17330108918608370189ULL,1533223081929501252ULL,9032221229430595433ULL,0,0,85744951902259612ULL,5072914322092137863ULL,1705557957893756992ULL,10786534327977901886ULL,171055579667516423ULL,12924737413339982175ULL,16740178879546805369ULL,1381545967461782227ULL,0,0,3884297591412308228ULL,11482872140661275513ULL,4532672523855618611ULL,5402165089034676429ULL,911196135802991530ULL,5721628401196675474ULL,9845601803218810675ULL,8121722726619544262ULL,0,0,},{6418390600164794941ULL,10798681683410088481ULL,10547572856502128731ULL,11265706971937695313ULL,9631841427514440541ULL,14253161230444409170ULL,3487965410964113806ULL,1348106002602736901ULL,0,0,13559874913807119612ULL,10556648567901077473ULL,10989223534398043198ULL,11069034901933776691ULL,11527009430806237762ULL,17983299841967046292ULL,17362943787638332501ULL,4355076706608268429ULL,0,0,7398716852201294433ULL,3041100610853721552ULL,8728113967719027725ULL,16897271881581495344ULL,11559405001618486843ULL,14636084054508994076ULL,5716513312488662692ULL,10828823829382206079ULL,0,0,3512684089851768805ULL,12075585818471924944ULL,13484556783224448151ULL,15544587733611659637ULL,1008545732055793944ULL,11759370880280705660ULL,5249745689662851170ULL,3624394618964842085ULL,0,0,17358057200071991236ULL,8993023195683161014ULL,11578690971495685696ULL,17178376515465460272ULL,13353295228484708474ULL,14529424297291004576ULL,4177824568197517782ULL,13748400752274061640ULL,0,0,7778988443811410815ULL,9252047330384659383ULL,11454369011308009369ULL,12423510493999914261ULL,15198953130483956632ULL,12508108169177652322ULL,11196143702339112515ULL,849144443972678235ULL,0,0,5366042653427013937ULL,5044836495604047913ULL,12913407561520745160ULL,168581266862557880ULL,892257883531561177ULL,16559758963868987272ULL,11085137818217774471ULL,10180537358702560037ULL,0,0,1183416690486707853ULL,8304998909831325816ULL,9262385289123743569ULL,3718330567954916309ULL,6057578968889374870ULL,15584182902957246979ULL,2268827376874419298ULL,15736223385328115852ULL,0,0,},{15261407655259884641ULL,6244772600951701528ULL,3118012417176200953ULL,5971253186274813512ULL,14037006370725304708ULL,17961850548499832383ULL,6781089859894055876ULL,13196764110493140908ULL,0,0,10732594033709189751ULL,1966081860983889306ULL,2246365929802474402ULL,1642668612429494448ULL,17667645484694221079ULL,2523580807291849034ULL,10885405289193129036ULL,16070177209578491048ULL,0,0,682335792039501995ULL,5415849263638585055ULL,16260966945392556483ULL,9806901350907091206ULL,11681587348973866521ULL,8154621732281042944ULL,9387085288892430557ULL,3682925334573723175ULL,0,0,12140442299651313005ULL,12947662377909817347ULL,16865635944331379928ULL,8541161170937428210ULL,9162955100843081522ULL,4285602076825985820ULL,6885657696468527016ULL,15382475835277286727ULL,0,0,16065429524077061306ULL,12530149097919388974ULL,15500518840829283143ULL,79701154536258008ULL,3696985018356685969ULL,16322529325561111026ULL,13566837391492536286ULL,7659719702928955188ULL,0,0,3954335125532835028ULL,13990604166907934200ULL,10832319170127141235ULL,9151285123481991033ULL,9791388198911030927ULL,330527411129058352ULL,11227821130749543551ULL,3628005836801336230ULL,0,0,2733238636323519199ULL,17700017727151708480ULL,1829534188351408474ULL,5113833927428373148ULL,11894505290753464328ULL,669023595704811611ULL,11450903236206089569ULL,13236846441918391300ULL,0,0,1098736199991765674ULL,11294852253205023906ULL,3364355597830055960ULL,13175718524289921977ULL,9402714673807124443ULL,9483155878108828840ULL,7413666785212852097ULL,9927366268453078920ULL,0,0,},{14932400091498415929ULL,2225884169444427277ULL,7778253887750064800ULL,2604954496734660665ULL,9865180094071390941ULL,11108165687462577140ULL,18188462914761569199ULL,8014163298514777029ULL,0,0,9973498636328004610ULL,16712054976334098779ULL,13849364616523297164ULL,18381091770455603837ULL,14207639838992564363ULL,4411841014672487555ULL,3519411022409239127ULL,12495135549364646006ULL,0,0,7111209557484616406ULL,6400497572114594006ULL,110650349332432029ULL,1742473191605151822ULL,3624566459699234627ULL,14982699022111008388ULL,16283559766076819334ULL,15932000525503184649ULL,0,0,16452413828784968906ULL,12278400056105609448ULL,17721685876795990568ULL,16848964164354909434ULL,10374742828448542609ULL,7868074289502595334ULL,11227203845265157251ULL,15976775039839642025ULL,0,0,979648895853525837ULL,13399008201626333310ULL,13676063718391391261ULL,90585445590455763ULL,9934731534070512068ULL,1918207312473253293ULL,7997907791709396066ULL,14991162669877674395ULL,0,0,7328742574294029168ULL,17051531180120844925ULL,318655917490699257ULL,9419749912976055229ULL,7616169265156676355ULL,15846361897535787035ULL,1129047973846456305ULL,9030568364430383492ULL,0,0,14802294019749965891ULL,14621885716402095979ULL,9953980082803523578ULL,6070353373864052970ULL,14575096362250000993ULL,2465647768894274238ULL,15992120879468557472ULL,2079613040941731860ULL,0,0,8413106732640660401ULL,658583431217496376ULL,294920781974011157ULL,3541847112818412604ULL,11211491318567598927ULL,7150213768029909230ULL,796670500901612374ULL,3220635951316110930ULL,0,0,},{4905938822370460362ULL,5034203063775638119ULL,14140911575401691940ULL,6288661950726353994ULL,10761443284915716811ULL,13529279512405766935ULL,14340362918974597040ULL,9300364919147442981ULL,0,0,11533614609267944219ULL,16747005497647345914ULL,6343661169944166493ULL,16200955028660891684ULL,17002398504875586688ULL,3419249036035170728ULL,17678177443255459263ULL,8459292702486185380ULL,0,0,4603684788569291541ULL,3304401906258410482ULL,4829308868093038630ULL,15364544933404879055ULL,3734643158039494027ULL,4836576576312080116ULL,6366469096631510188ULL,9615289327088055028ULL,0,0,17782472613238601581ULL,14704485741953972698ULL,2929162723966800252ULL,17295164646707174833ULL,283978297467456258ULL,1461212704199518937ULL,11645983930521480351ULL,16395201168154788968ULL,0,0,14048936915336379821ULL,17561497143397526279ULL,1524343404608003333ULL,15164052175426322206ULL,7823921401719711680ULL,6293523369979507792ULL,166106974219543970ULL,14582426414191383325ULL,0,0,12494997043312710721ULL,5386027198469121703ULL,12189125339000494093ULL,18323180686025206106ULL,6832525433316507030ULL,11423981113459407574ULL,16647565231320212109ULL,10512276283069448457ULL,0,0,16019490847362938949ULL,8063135482435113268ULL,673237423857484419ULL,6525638293896100670ULL,12820745401965537296ULL,1824495315844838561ULL,550302278691646824ULL,16184130343321003876ULL,0,0,16938685161855735955ULL,2392101696366084823ULL,4973690626494363757ULL,610368751500865804ULL,17044253726012122469ULL,7043379469424944114ULL,3057064162676289544ULL,5260412029521111908ULL,0,0,},{5244956469528694384ULL,15188280693463717633ULL,7940886018769738255ULL,6966765411241119217ULL,6674010252574331611ULL,4386998180016139042ULL,17487411500725569574ULL,3946585561366834046ULL,0,0,2208053568392447656ULL,16636979463892200830ULL,17567014929177426927ULL,10570139372218786480ULL,5086532175765079167ULL,7871713741463933130ULL,11688853438383627999ULL,9525113203672208288ULL,0,0,7036353440516444175ULL,270703028010966348ULL,1921667556519236602ULL,15661284267499174711ULL,14907988177282581014ULL,10817173630558095511ULL,4552341326874552306ULL,2360095527808530404ULL,0,0,15649191812914541460ULL,7723120738675199760ULL,14879602975708521294ULL,11210976695171182136ULL,15724623746587511723ULL,17545378103601234790ULL,8108620177781061056ULL,838460441343918020ULL,0,0,5027396329109468803ULL,3470140887391490902ULL,10914369868946837388ULL,8138664905263610928ULL,10741441732576103584ULL,4195484806268700909ULL,18201256265814300318ULL,17109238924786621630ULL,0,0,13640823520361358487ULL,4019712512249701658ULL,12156933533891872852ULL,4597643467377464426ULL,14788616679967752233ULL,12526668331844342654ULL,2924726547933039805ULL,3930774100689039406ULL,0,0,11032733921183353746ULL,5052946960791537331ULL,14164414392224631013ULL,7617849465435585821ULL,17987664775726303664ULL,9179221701048995450ULL,7199033476951675084ULL,6790502382209392924ULL,0,0,6944109911994036404ULL,739458865719700411ULL,11463685164407831098ULL,8235597206738953477ULL,16638406588037095610ULL,7375954043915892863ULL,8006172339323979801ULL,4807004627576728273ULL,0,0,},},{{4684601674177657733ULL,11044255351182035870ULL,568769251628422603ULL,13569816392816428733ULL,11513702594140843510ULL,15837153834503924200ULL,10662188674645711626ULL,3662975661977117749ULL,0,0,12716603653663620557ULL,11453928455864331646ULL,15388011980976202061ULL,11350559548161594234ULL,18410523106724761279ULL,11747023228030566417ULL,17367867389665909185ULL,14029931630891563889ULL,0,0,16469661281322371977ULL,14870469840880807042ULL,7316495785349773919ULL,17527396183611806807ULL,14229361052603990439ULL,10053560069907491796ULL,18112991269051837554ULL,487257815795075064ULL,0,0,2803854852697583226ULL,1019788329170733358ULL,1853777268934257210ULL,4835985635035653786ULL,14718299891906740588ULL,1300594922681941432ULL,11844763913238941518ULL,6409978710596125782ULL,0,0,12371825315833523842ULL,11594067592022671918ULL,3965900672939344587ULL,15376678248794605142ULL,2626006836543715485ULL,8606208143741198763ULL,13705765062360227640ULL,14921208545568148232ULL,0,0,7730249546812796122ULL,2086119614903884289ULL,1776678126851370890ULL,14590414979900534866ULL,809522281319586232ULL,4909018723817696485ULL,5982298213035124319ULL,1109501683968207897ULL,0,0,17411129279257017357ULL,15598249067769378707ULL,14448713054734532378ULL,7108883246393600040ULL,9594890252785336007ULL,10582882020823080840ULL,2545954987058747272ULL,13220067807641671759ULL,0,0,14065523439197834863ULL,17775504717717276426ULL,10697636655478480361ULL,10423201473419201208ULL,4421874485485529100ULL,3638012815625434136ULL,17432157952017648082ULL,3545290425813408429ULL,0,0,},{9167623025885026578ULL,13645274567361511361ULL,9649050789997972163ULL,6685429760418202033ULL,9071881540041088806ULL,9655200812558547172ULL,6785528822683763581ULL,16385722659424719253ULL,0,0,8668527283951416376ULL,784605282027961768ULL,9387601540168506598ULL,12487526075174617882ULL,7380785902408068281ULL,3304455159900290529ULL,10836521292333179581ULL,7569151401979311776ULL,0,0,6433683744112698483ULL,9250220756039820840ULL,328835772982229788ULL,11250057486400974679ULL,1939747375302933968ULL,11945058332695603431ULL,11833723523122027736ULL,2264465459285807014ULL,0,0,16838324449977478566ULL,12003263667140291733ULL,16829401591419013988ULL,5348582218087200212ULL,2848480151293527507ULL,4380614107878964008ULL,1488465417074495234ULL,12555234739164445785ULL,0,0,6947031344777451059ULL,18257351120517534894ULL,1161874912409302005ULL,8454789081976278790ULL,17419988474332951845ULL,10029095857362591423ULL,11521574723563694625ULL,16613741703881419602ULL,0,0,3536097428935940275ULL,2103775946513779358ULL,18336297382352092715ULL,7262815750178310892ULL,6859244754473415990ULL,1495148513497497172ULL,12663833595839442569ULL,13367509860062767185ULL,0,0,16508232302637858934ULL,15280006247631164489ULL,16578528424503448772ULL,5469041327196839937ULL,8822596835040026134ULL,5946706610974605666ULL,8491518265766577150ULL,10659644284534582080ULL,0,0,120278346564104488ULL,9250075808212362405ULL,4275849578506910510ULL,16302634856303910111ULL,11012787458926536833ULL,12737543326621090907ULL,44393133756753102ULL,7280246386578009514ULL,0,0,},{14888681473644806244ULL,11684668428774774449ULL,17832634959750752301ULL,18340678936544536335ULL,5546333236996675572ULL,18425023556138291075ULL,514065084740335519ULL,13723957688630553523ULL,0,0,2116104913464424272ULL,17378269121157181219ULL,2793621877970885009ULL,5523858681983538907ULL,5263539400456537768ULL,2161722743535123570ULL,2489034928292879176ULL,5265114531195498824ULL,0,0,7648508315431211009ULL,986726328139979920ULL,9933073620644593914ULL,18120616563520061683ULL,4356303394811149501ULL,11049608748625367451ULL,17744082017179498186ULL,10017393428496602585ULL,0,0,13642742954323190280ULL,12637422661261061796ULL,7524279633090589795ULL,1002932607331396910ULL,18183694094871117475ULL,4597571021641717445ULL,10845712040344574406ULL,16551443287357649839ULL,0,0,5375397959598136222ULL,11070147220532183957ULL,11573702992674152929ULL,816509176753459843ULL,5466778547799153779ULL,7219022431771467309ULL,14343815497120683835ULL,5925523953969302118ULL,0,0,9505422571055073650ULL,12910836584513599447ULL,6299985034633599287ULL,2865215480305394071ULL,296544412155312942ULL,1864824225841999179ULL,16568824517483532676ULL,8315326244322262127ULL,0,0,12085847678114510175ULL,16244519530393558778ULL,5645331405017592515ULL,9067675365583859890ULL,3569177387594876878ULL,4993764635040412853ULL,8036587240194135087ULL,18380845472281559487ULL,0,0,5119139243869326319ULL,12184919191278123490ULL,12150520387884743181ULL,15497250426497546487ULL,9850160921164149500ULL,14036263736832454650ULL,3612491355254717946ULL,17126003938209831533ULL,0,0,},{10875798209576231062ULL,4917139815936242069ULL,13659952758672563936ULL,13174055081745361497ULL,11879825313048125217ULL,10317821801454245666ULL,12277656132059102290ULL,5552473049872220674ULL,0,0,13747373441069267374ULL,4355611199639507996ULL,8254966398732937613ULL,516953752584511849ULL,2188256745564870760ULL,18059981887931373614ULL,13564718687422687476ULL,8051674951164082026ULL,0,0,7554602974754328019ULL,16337077539777088430ULL,4503168333357747149ULL,4129421530629073217ULL,1618749620663669746ULL,4320819461114205914ULL,11680548853732580795ULL,1777627061212503588ULL,0,0,18358234805187233110ULL,13767814104271845789ULL,18370606457708852198ULL,796294887832488834ULL,7188940594364351075ULL,5822196978029845410ULL,17214420804468229292ULL,14433474701864361541ULL,0,0,17476643135669525585ULL,13317569830705750889ULL,13608581177301646912ULL,8071262772343432343ULL,8482375095688413636ULL,9208005565014175425ULL,7148373425726752932ULL,6119214473331208714ULL,0,0,14930702649110412429ULL,5442985695014876605ULL,10726004832800083754ULL,18010203353985590243ULL,7906659633613241504ULL,2280124615086407200ULL,3410231449686102845ULL,2895317680813189270ULL,0,0,617430890826160480ULL,5426498120915767151ULL,11137668120774625023ULL,8372841058426674710ULL,1260998084381550473ULL,1151122092302209328ULL,4814877633975019055ULL,13108526892548059388ULL,0,0,7234401878084220382ULL,5643195277356502946ULL,10836209979491304381ULL,15672452868074823918ULL,12867581552758430784ULL,18317289525924865889ULL,11073447625211818324ULL,1752095379804733695ULL,0,0,},{14824880053404841108ULL,13231150353320624566ULL,10675190456373489234ULL,8169314835163496329ULL,2656946427541317352ULL,612773720764900155ULL,8273803411079310116ULL,7737867517039938155ULL,0,0,15900130780292929020ULL,4967271389419806121ULL,9695088412288637047ULL,7531624688416107459ULL,10197638259660312819ULL,6945057185177540007ULL,2656497237794391340ULL,18131153577458235430ULL,0,0,880302667633963568ULL,13536185071760613425ULL,17407171846986619887ULL,13334397842183788604ULL,18053479402119697589ULL,8543027083093981733ULL,10753334297271721746ULL,7046903166919267775ULL,0,0,8654689332130778229ULL,11975858083791104314ULL,4115241684238339353ULL,13940987044810699397ULL,15378789508600779842ULL,7807227767982563438ULL,15412915784362493282ULL,8294661155894252596ULL,0,0,12505619918511230402ULL,8440001764585071475ULL,7215691699210132131ULL,395842657061532976ULL,18073305692692651341ULL,7531314454729229676ULL,17175533184676704004ULL,15558796680064457336ULL,0,0,8216891388141837625ULL,15536520852628507245ULL,10326388093775670155ULL,18242574987379145071ULL,10248318580654763140ULL,3170397202380502784ULL,9050891629689570713ULL,17146722180108629489ULL,0,0,6687638613654274868ULL,14303294565406811564ULL,11064420695029253663ULL,13224913489676671374ULL,5321174601978704735ULL,16344256643594743836ULL,5612348724103452223ULL,11729258488540307693ULL,0,0,12148508211594588140ULL,18141432251581361577ULL,6164926601705541641ULL,10111997822437271683ULL,2771996132087204677ULL,6745260053171566883ULL,15378956669921204577ULL,15246107516857501546ULL,0,0,},{15183435648137911298ULL,18177548260560869566ULL,9245421841666689148ULL,2956067775602717478ULL,9146084545561727763ULL,10043784485037597781ULL,16486004647593846985ULL,4802759627871536832ULL,0,0,14400313234048289956ULL,3942260884932549452ULL,3313802327969402534ULL,2503624355908241904ULL,5387414430088654964ULL,11864186913715121847ULL,3242366657310915050ULL,17546491740015993369ULL,0,0,5655617085991042107ULL,5398852764000572999ULL,1672366728509183177ULL,7692198725878732368ULL,12905700308374554401ULL,15866533234800324866ULL,17424242934360685476ULL,8717338386795125070ULL,0,0,1541504966948892830ULL,11468775038760818967ULL,5450287603221478610ULL,13044284175965263716ULL,5912467131361226769ULL,5050704457256743350ULL,5033534344650623526ULL,18227902371379741698ULL,0,0,6273306700773258657ULL,12844327552335885647ULL,4914940742737233723ULL,4902412069432565276ULL,10355583822955021729ULL,4148187645286386289ULL,13709874547792778387ULL,10491924038546893002ULL,0,0,10464871296241642722ULL,5339832502952562330ULL,9364492615480999184ULL,11270501147467783853ULL,14517686523799483160ULL,9095918098546494387ULL,16079192427655976829ULL,9793164603274587477ULL,0,0,6981657576379502552ULL,4675020297088480546ULL,15255559270153174472ULL,15275970808302994941ULL,10344316727974969726ULL,9710088814022923562ULL,7411830437382611757ULL,15558278354380242995ULL,0,0,15544325303648081343ULL,17265148248740124962ULL,15375088858546792285ULL,12291430685298981884ULL,8539918095506988721ULL,2735003535139918042ULL,5315489664230148640ULL,8804180957363905139ULL,0,0,},},};
 unsigned long long ZCASTLE[MAX_PLAYER][2] = {{6203253927586826328ULL,8067165715096375966ULL,},{8173714954123157941ULL,12992958070307811105ULL,},};
 unsigned long long ZPLAYER = 12980410087419402005ULL;
+
+/**
+ * POLYGLOT_RANDOM (Random64 of the Polyglot opening book format, for keys of positions in .bin books)
+ * ├── 0...767: 64*kind + 8*row + file, kind: 2*shape + 1 if white (see enum Shape), row: 0 is white's first rank
+ * ├── POLYGLOT_CASTLE...+3: castle rights of white's king side, white's queen side, black's king side, black's queen side
+ * ├── POLYGLOT_EP...+7: file of the en passant target square, only if a pawn of the side to move can capture there
+ * └── POLYGLOT_TURN: white to move
+ */
+const short POLYGLOT_CASTLE = 768, POLYGLOT_EP = 772, POLYGLOT_TURN = 780, POLYGLOT_RANDOM_SZ = 781;
+const unsigned long long POLYGLOT_RANDOM[POLYGLOT_RANDOM_SZ] = {0x9D39247E33776D41ULL,0x2AF7398005AAA5C7ULL,0x44DB015024623547ULL,0x9C15F73E62A76AE2ULL,0x75834465489C0C89ULL,0x3290AC3A203001BFULL,0x0FBBAD1F61042279ULL,0xE83A908FF2FB60CAULL,0x0D7E765D58755C10ULL,0x1A083822CEAFE02DULL,0x9605D5F0E25EC3B0ULL,0xD021FF5CD13A2ED5ULL,0x40BDF15D4A672E32ULL,0x011355146FD56395ULL,0x5DB4832046F3D9E5ULL,0x239F8B2D7FF719CCULL,0x05D1A1AE85B49AA1ULL,0x679F848F6E8FC971ULL,0x7449BBFF801FED0BULL,0x7D11CDB1C3B7ADF0ULL,0x82C7709E781EB7CCULL,0xF3218F1C9510786CULL,0x331478F3AF51BBE6ULL,0x4BB38DE5E7219443ULL,0xAA649C6EBCFD50FCULL,0x8DBD98A352AFD40BULL,0x87D2074B81D79217ULL,0x19F3C751D3E92AE1ULL,0xB4AB30F062B19ABFULL,0x7B0500AC42047AC4ULL,0xC9452CA81A09D85DULL,0x24AA6C514DA27500ULL,0x4C9F34427501B447ULL,0x14A68FD73C910841ULL,0xA71B9B83461CBD93ULL,0x03488B95B0F1850FULL,0x637B2B34FF93C040ULL,0x09D1BC9A3DD90A94ULL,0x3575668334A1DD3BULL,0x735E2B97A4C45A23ULL,0x18727070F1BD400BULL,0x1FCBACD259BF02E7ULL,0xD310A7C2CE9B6555ULL,0xBF983FE0FE5D8244ULL,0x9F74D14F7454A824ULL,0x51EBDC4AB9BA3035ULL,0x5C82C505DB9AB0FAULL,0xFCF7FE8A3430B241ULL,0x3253A729B9BA3DDEULL,0x8C74C368081B3075ULL,0xB9BC6C87167C33E7ULL,0x7EF48F2B83024E20ULL,0x11D505D4C351BD7FULL,0x6568FCA92C76A243ULL,0x4DE0B0F40F32A7B8ULL,0x96D693460CC37E5DULL,0x42E240CB63689F2FULL,0x6D2BDCDAE2919661ULL,0x42880B0236E4D951ULL,0x5F0F4A5898171BB6ULL,0x39F890F579F92F88ULL,0x93C5B5F47356388BULL,0x63DC359D8D231B78ULL,0xEC16CA8AEA98AD76ULL,0x5355F900C2A82DC7ULL,0x07FB9F855A997142ULL,0x5093417AA8A7ED5EULL,0x7BCBC38DA25A7F3CULL,0x19FC8A768CF4B6D4ULL,0x637A7780DECFC0D9ULL,0x8249A47AEE0E41F7ULL,0x79AD695501E7D1E8ULL,0x14ACBAF4777D5776ULL,0xF145B6BECCDEA195ULL,0xDABF2AC8201752FCULL,0x24C3C94DF9C8D3F6ULL,0xBB6E2924F03912EAULL,0x0CE26C0B95C980D9ULL,0xA49CD132BFBF7CC4ULL,0xE99D662AF4243939ULL,0x27E6AD7891165C3FULL,0x8535F040B9744FF1ULL,0x54B3F4FA5F40D873ULL,0x72B12C32127FED2BULL,0xEE954D3C7B411F47ULL,0x9A85AC909A24EAA1ULL,0x70AC4CD9F04F21F5ULL,0xF9B89D3E99A075C2ULL,0x87B3E2B2B5C907B1ULL,0xA366E5B8C54F48B8ULL,0xAE4A9346CC3F7CF2ULL,0x1920C04D47267BBDULL,0x87BF02C6B49E2AE9ULL,0x092237AC237F3859ULL,0xFF07F64EF8ED14D0ULL,0x8DE8DCA9F03CC54EULL,0x9C1633264DB49C89ULL,0xB3F22C3D0B0B38EDULL,0x390E5FB44D01144BULL,0x5BFEA5B4712768E9ULL,0x1E1032911FA78984ULL,0x9A74ACB964E78CB3ULL,0x4F80F7A035DAFB04ULL,0x6304D09A0B3738C4ULL,0x2171E64683023A08ULL,0x5B9B63EB9CEFF80CULL,0x506AACF489889342ULL,0x1881AFC9A3A701D6ULL,0x6503080440750644ULL,0xDFD395339CDBF4A7ULL,0xEF927DBCF00C20F2ULL,0x7B32F7D1E03680ECULL,0xB9FD7620E7316243ULL,0x05A7E8A57DB91B77ULL,0xB5889C6E15630A75ULL,0x4A750A09CE9573F7ULL,0xCF464CEC899A2F8AULL,0xF538639CE705B824ULL,0x3C79A0FF5580EF7FULL,0xEDE6C87F8477609DULL,0x799E81F05BC93F31ULL,0x86536B8CF3428A8CULL,0x97D7374C60087B73ULL,0xA246637CFF328532ULL,0x043FCAE60CC0EBA0ULL,0x920E449535DD359EULL,0x70EB093B15B290CCULL,0x73A1921916591CBDULL,0x56436C9FE1A1AA8DULL,0xEFAC4B70633B8F81ULL,0xBB215798D45DF7AFULL,0x45F20042F24F1768ULL,0x930F80F4E8EB7462ULL,0xFF6712FFCFD75EA1ULL,0xAE623FD67468AA70ULL,0xDD2C5BC84BC8D8FCULL,0x7EED120D54CF2DD9ULL,0x22FE545401165F1CULL,0xC91800E98FB99929ULL,0x808BD68E6AC10365ULL,0xDEC468145B7605F6ULL,0x1BEDE3A3AEF53302ULL,0x43539603D6C55602ULL,0xAA969B5C691CCB7AULL,0xA87832D392EFEE56ULL,0x65942C7B3C7E11AEULL,0xDED2D633CAD004F6ULL,0x21F08570F420E565ULL,0xB415938D7DA94E3CULL,0x91B859E59ECB6350ULL,0x10CFF333E0ED804AULL,0x28AED140BE0BB7DDULL,0xC5CC1D89724FA456ULL,0x5648F680F11A2741ULL,0x2D255069F0B7DAB3ULL,0x9BC5A38EF729ABD4ULL,0xEF2F054308F6A2BCULL,0xAF2042F5CC5C2858ULL,0x480412BAB7F5BE2AULL,0xAEF3AF4A563DFE43ULL,0x19AFE59AE451497FULL,0x52593803DFF1E840ULL,0xF4F076E65F2CE6F0ULL,0x11379625747D5AF3ULL,0xBCE5D2248682C115ULL,0x9DA4243DE836994FULL,0x066F70B33FE09017ULL,0x4DC4DE189B671A1CULL,0x51039AB7712457C3ULL,0xC07A3F80C31FB4B4ULL,0xB46EE9C5E64A6E7CULL,0xB3819A42ABE61C87ULL,0x21A007933A522A20ULL,0x2DF16F761598AA4FULL,0x763C4A1371B368FDULL,0xF793C46702E086A0ULL,0xD7288E012AEB8D31ULL,0xDE336A2A4BC1C44BULL,0x0BF692B38D079F23ULL,0x2C604A7A177326B3ULL,0x4850E73E03EB6064ULL,0xCFC447F1E53C8E1BULL,0xB05CA3F564268D99ULL,0x9AE182C8BC9474E8ULL,0xA4FC4BD4FC5558CAULL,0xE755178D58FC4E76ULL,0x69B97DB1A4C03DFEULL,0xF9B5B7C4ACC67C96ULL,0xFC6A82D64B8655FBULL,0x9C684CB6C4D24417ULL,0x8EC97D2917456ED0ULL,0x6703DF9D2924E97EULL,0xC547F57E42A7444EULL,0x78E37644E7CAD29EULL,0xFE9A44E9362F05FAULL,0x08BD35CC38336615ULL,0x9315E5EB3A129ACEULL,0x94061B871E04DF75ULL,0xDF1D9F9D784BA010ULL,0x3BBA57B68871B59DULL,0xD2B7ADEEDED1F73FULL,0xF7A255D83BC373F8ULL,0xD7F4F2448C0CEB81ULL,0xD95BE88CD210FFA7ULL,0x336F52F8FF4728E7ULL,0xA74049DAC312AC71ULL,0xA2F61BB6E437FDB5ULL,0x4F2A5CB07F6A35B3ULL,0x87D380BDA5BF7859ULL,0x16B9F7E06C453A21ULL,0x7BA2484C8A0FD54EULL,0xF3A678CAD9A2E38CULL,0x39B0BF7DDE437BA2ULL,0xFCAF55C1BF8A4424ULL,0x18FCF680573FA594ULL,0x4C0563B89F495AC3ULL,0x40E087931A00930DULL,0x8CFFA9412EB642C1ULL,0x68CA39053261169FULL,0x7A1EE967D27579E2ULL,0x9D1D60E5076F5B6FULL,0x3810E399B6F65BA2ULL,0x32095B6D4AB5F9B1ULL,0x35CAB62109DD038AULL,0xA90B24499FCFAFB1ULL,0x77A225A07CC2C6BDULL,0x513E5E634C70E331ULL,0x4361C0CA3F692F12ULL,0xD941ACA44B20A45BULL,0x528F7C8602C5807BULL,0x52AB92BEB9613989ULL,0x9D1DFA2EFC557F73ULL,0x722FF175F572C348ULL,0x1D1260A51107FE97ULL,0x7A249A57EC0C9BA2ULL,0x04208FE9E8F7F2D6ULL,0x5A110C6058B920A0ULL,0x0CD9A497658A5698ULL,0x56FD23C8F9715A4CULL,0x284C847B9D887AAEULL,0x04FEABFBBDB619CBULL,0x742E1E651C60BA83ULL,0x9A9632E65904AD3CULL,0x881B82A13B51B9E2ULL,0x506E6744CD974924ULL,0xB0183DB56FFC6A79ULL,0x0ED9B915C66ED37EULL,0x5E11E86D5873D484ULL,0xF678647E3519AC6EULL,0x1B85D488D0F20CC5ULL,0xDAB9FE6525D89021ULL,0x0D151D86ADB73615ULL,0xA865A54EDCC0F019ULL,0x93C42566AEF98FFBULL,0x99E7AFEABE000731ULL,0x48CBFF086DDF285AULL,0x7F9B6AF1EBF78BAFULL,0x58627E1A149BBA21ULL,0x2CD16E2ABD791E33ULL,0xD363EFF5F0977996ULL,0x0CE2A38C344A6EEDULL,0x1A804AADB9CFA741ULL,0x907F30421D78C5DEULL,0x501F65EDB3034D07ULL,0x37624AE5A48FA6E9ULL,0x957BAF61700CFF4EULL,0x3A6C27934E31188AULL,0xD49503536ABCA345ULL,0x088E049589C432E0ULL,0xF943AEE7FEBF21B8ULL,0x6C3B8E3E336139D3ULL,0x364F6FFA464EE52EULL,0xD60F6DCEDC314222ULL,0x56963B0DCA418FC0ULL,0x16F50EDF91E513AFULL,0xEF1955914B609F93ULL,0x565601C0364E3228ULL,0xECB53939887E8175ULL,0xBAC7A9A18531294BULL,0xB344C470397BBA52ULL,0x65D34954DAF3CEBDULL,0xB4B81B3FA97511E2ULL,0xB422061193D6F6A7ULL,0x071582401C38434DULL,0x7A13F18BBEDC4FF5ULL,0xBC4097B116C524D2ULL,0x59B97885E2F2EA28ULL,0x99170A5DC3115544ULL,0x6F423357E7C6A9F9ULL,0x325928EE6E6F8794ULL,0xD0E4366228B03343ULL,0x565C31F7DE89EA27ULL,0x30F5611484119414ULL,0xD873DB391292ED4FULL,0x7BD94E1D8E17DEBCULL,0xC7D9F16864A76E94ULL,0x947AE053EE56E63CULL,0xC8C93882F9475F5FULL,0x3A9BF55BA91F81CAULL,0xD9A11FBB3D9808E4ULL,0x0FD22063EDC29FCAULL,0xB3F256D8ACA0B0B9ULL,0xB03031A8B4516E84ULL,0x35DD37D5871448AFULL,0xE9F6082B05542E4EULL,0xEBFAFA33D7254B59ULL,0x9255ABB50D532280ULL,0xB9AB4CE57F2D34F3ULL,0x693501D628297551ULL,0xC62C58F97DD949BFULL,0xCD454F8F19C5126AULL,0xBBE83F4ECC2BDECBULL,0xDC842B7E2819E230ULL,0xBA89142E007503B8ULL,0xA3BC941D0A5061CBULL,0xE9F6760E32CD8021ULL,0x09C7E552BC76492FULL,0x852F54934DA55CC9ULL,0x8107FCCF064FCF56ULL,0x098954D51FFF6580ULL,0x23B70EDB1955C4BFULL,0xC330DE426430F69DULL,0x4715ED43E8A45C0AULL,0xA8D7E4DAB780A08DULL,0x0572B974F03CE0BBULL,0xB57D2E985E1419C7ULL,0xE8D9ECBE2CF3D73FULL,0x2FE4B17170E59750ULL,0x11317BA87905E790ULL,0x7FBF21EC8A1F45ECULL,0x1725CABFCB045B00ULL,0x964E915CD5E2B207ULL,0x3E2B8BCBF016D66DULL,0xBE7444E39328A0ACULL,0xF85B2B4FBCDE44B7ULL,0x49353FEA39BA63B1ULL,0x1DD01AAFCD53486AULL,0x1FCA8A92FD719F85ULL,0xFC7C95D827357AFAULL,0x18A6A990C8B35EBDULL,0xCCCB7005C6B9C28DULL,0x3BDBB92C43B17F26ULL,0xAA70B5B4F89695A2ULL,0xE94C39A54A98307FULL,0xB7A0B174CFF6F36EULL,0xD4DBA84729AF48ADULL,0x2E18BC1AD9704A68ULL,0x2DE0966DAF2F8B1CULL,0xB9C11D5B1E43A07EULL,0x64972D68DEE33360ULL,0x94628D38D0C20584ULL,0xDBC0D2B6AB90A559ULL,0xD2733C4335C6A72FULL,0x7E75D99D94A70F4DULL,0x6CED1983376FA72BULL,0x97FCAACBF030BC24ULL,0x7B77497B32503B12ULL,0x8547EDDFB81CCB94ULL,0x79999CDFF70902CBULL,0xCFFE1939438E9B24ULL,0x829626E3892D95D7ULL,0x92FAE24291F2B3F1ULL,0x63E22C147B9C3403ULL,0xC678B6D860284A1CULL,0x5873888850659AE7ULL,0x0981DCD296A8736DULL,0x9F65789A6509A440ULL,0x9FF38FED72E9052FULL,0xE479EE5B9930578CULL,0xE7F28ECD2D49EECDULL,0x56C074A581EA17FEULL,0x5544F7D774B14AEFULL,0x7B3F0195FC6F290FULL,0x12153635B2C0CF57ULL,0x7F5126DBBA5E0CA7ULL,0x7A76956C3EAFB413ULL,0x3D5774A11D31AB39ULL,0x8A1B083821F40CB4ULL,0x7B4A38E32537DF62ULL,0x950113646D1D6E03ULL,0x4DA8979A0041E8A9ULL,0x3BC36E078F7515D7ULL,0x5D0A12F27AD310D1ULL,0x7F9D1A2E1EBE1327ULL,0xDA3A361B1C5157B1ULL,0xDCDD7D20903D0C25ULL,0x36833336D068F707ULL,0xCE68341F79893389ULL,0xAB9090168DD05F34ULL,0x43954B3252DC25E5ULL,0xB438C2B67F98E5E9ULL,0x10DCD78E3851A492ULL,0xDBC27AB5447822BFULL,0x9B3CDB65F82CA382ULL,0xB67B7896167B4C84ULL,0xBFCED1B0048EAC50ULL,0xA9119B60369FFEBDULL,0x1FFF7AC80904BF45ULL,0xAC12FB171817EEE7ULL,0xAF08DA9177DDA93DULL,0x1B0CAB936E65C744ULL,0xB559EB1D04E5E932ULL,0xC37B45B3F8D6F2BAULL,0xC3A9DC228CAAC9E9ULL,0xF3B8B6675A6507FFULL,0x9FC477DE4ED681DAULL,0x67378D8ECCEF96CBULL,0x6DD856D94D259236ULL,0xA319CE15B0B4DB31ULL,0x073973751F12DD5EULL,0x8A8E849EB32781A5ULL,0xE1925C71285279F5ULL,0x74C04BF1790C0EFEULL,0x4DDA48153C94938AULL,0x9D266D6A1CC0542CULL,0x7440FB816508C4FEULL,0x13328503DF48229FULL,0xD6BF7BAEE43CAC40ULL,0x4838D65F6EF6748FULL,0x1E152328F3318DEAULL,0x8F8419A348F296BFULL,0x72C8834A5957B511ULL,0xD7A023A73260B45CULL,0x94EBC8ABCFB56DAEULL,0x9FC10D0F989993E0ULL,0xDE68A2355B93CAE6ULL,0xA44CFE79AE538BBEULL,0x9D1D84FCCE371425ULL,0x51D2B1AB2DDFB636ULL,0x2FD7E4B9E72CD38CULL,0x65CA5B96B7552210ULL,0xDD69A0D8AB3B546DULL,0x604D51B25FBF70E2ULL,0x73AA8A564FB7AC9EULL,0x1A8C1E992B941148ULL,0xAAC40A2703D9BEA0ULL,0x764DBEAE7FA4F3A6ULL,0x1E99B96E70A9BE8BULL,0x2C5E9DEB57EF4743ULL,0x3A938FEE32D29981ULL,0x26E6DB8FFDF5ADFEULL,0x469356C504EC9F9DULL,0xC8763C5B08D1908CULL,0x3F6C6AF859D80055ULL,0x7F7CC39420A3A545ULL,0x9BFB227EBDF4C5CEULL,0x89039D79D6FC5C5CULL,0x8FE88B57305E2AB6ULL,0xA09E8C8C35AB96DEULL,0xFA7E393983325753ULL,0xD6B6D0ECC617C699ULL,0xDFEA21EA9E7557E3ULL,0xB67C1FA481680AF8ULL,0xCA1E3785A9E724E5ULL,0x1CFC8BED0D681639ULL,0xD18D8549D140CAEAULL,0x4ED0FE7E9DC91335ULL,0xE4DBF0634473F5D2ULL,0x1761F93A44D5AEFEULL,0x53898E4C3910DA55ULL,0x734DE8181F6EC39AULL,0x2680B122BAA28D97ULL,0x298AF231C85BAFABULL,0x7983EED3740847D5ULL,0x66C1A2A1A60CD889ULL,0x9E17E49642A3E4C1ULL,0xEDB454E7BADC0805ULL,0x50B704CAB602C329ULL,0x4CC317FB9CDDD023ULL,0x66B4835D9EAFEA22ULL,0x219B97E26FFC81BDULL,0x261E4E4C0A333A9DULL,0x1FE2CCA76517DB90ULL,0xD7504DFA8816EDBBULL,0xB9571FA04DC089C8ULL,0x1DDC0325259B27DEULL,0xCF3F4688801EB9AAULL,0xF4F5D05C10CAB243ULL,0x38B6525C21A42B0EULL,0x36F60E2BA4FA6800ULL,0xEB3593803173E0CEULL,0x9C4CD6257C5A3603ULL,0xAF0C317D32ADAA8AULL,0x258E5A80C7204C4BULL,0x8B889D624D44885DULL,0xF4D14597E660F855ULL,0xD4347F66EC8941C3ULL,0xE699ED85B0DFB40DULL,0x2472F6207C2D0484ULL,0xC2A1E7B5B459AEB5ULL,0xAB4F6451CC1D45ECULL,0x63767572AE3D6174ULL,0xA59E0BD101731A28ULL,0x116D0016CB948F09ULL,0x2CF9C8CA052F6E9FULL,0x0B090A7560A968E3ULL,0xABEEDDB2DDE06FF1ULL,0x58EFC10B06A2068DULL,0xC6E57A78FBD986E0ULL,0x2EAB8CA63CE802D7ULL,0x14A195640116F336ULL,0x7C0828DD624EC390ULL,0xD74BBE77E6116AC7ULL,0x804456AF10F5FB53ULL,0xEBE9EA2ADF4321C7ULL,0x03219A39EE587A30ULL,0x49787FEF17AF9924ULL,0xA1E9300CD8520548ULL,0x5B45E522E4B1B4EFULL,0xB49C3B3995091A36ULL,0xD4490AD526F14431ULL,0x12A8F216AF9418C2ULL,0x001F837CC7350524ULL,0x1877B51E57A764D5ULL,0xA2853B80F17F58EEULL,0x993E1DE72D36D310ULL,0xB3598080CE64A656ULL,0x252F59CF0D9F04BBULL,0xD23C8E176D113600ULL,0x1BDA0492E7E4586EULL,0x21E0BD5026C619BFULL,0x3B097ADAF088F94EULL,0x8D14DEDB30BE846EULL,0xF95CFFA23AF5F6F4ULL,0x3871700761B3F743ULL,0xCA672B91E9E4FA16ULL,0x64C8E531BFF53B55ULL,0x241260ED4AD1E87DULL,0x106C09B972D2E822ULL,0x7FBA195410E5CA30ULL,0x7884D9BC6CB569D8ULL,0x0647DFEDCD894A29ULL,0x63573FF03E224774ULL,0x4FC8E9560F91B123ULL,0x1DB956E450275779ULL,0xB8D91274B9E9D4FBULL,0xA2EBEE47E2FBFCE1ULL,0xD9F1F30CCD97FB09ULL,0xEFED53D75FD64E6BULL,0x2E6D02C36017F67FULL,0xA9AA4D20DB084E9BULL,0xB64BE8D8B25396C1ULL,0x70CB6AF7C2D5BCF0ULL,0x98F076A4F7A2322EULL,0xBF84470805E69B5FULL,0x94C3251F06F90CF3ULL,0x3E003E616A6591E9ULL,0xB925A6CD0421AFF3ULL,0x61BDD1307C66E300ULL,0xBF8D5108E27E0D48ULL,0x240AB57A8B888B20ULL,0xFC87614BAF287E07ULL,0xEF02CDD06FFDB432ULL,0xA1082C0466DF6C0AULL,0x8215E577001332C8ULL,0xD39BB9C3A48DB6CFULL,0x2738259634305C14ULL,0x61CF4F94C97DF93DULL,0x1B6BACA2AE4E125BULL,0x758F450C88572E0BULL,0x959F587D507A8359ULL,0xB063E962E045F54DULL,0x60E8ED72C0DFF5D1ULL,0x7B64978555326F9FULL,0xFD080D236DA814BAULL,0x8C90FD9B083F4558ULL,0x106F72FE81E2C590ULL,0x7976033A39F7D952ULL,0xA4EC0132764CA04BULL,0x733EA705FAE4FA77ULL,0xB4D8F77BC3E56167ULL,0x9E21F4F903B33FD9ULL,0x9D765E419FB69F6DULL,0xD30C088BA61EA5EFULL,0x5D94337FBFAF7F5BULL,0x1A4E4822EB4D7A59ULL,0x6FFE73E81B637FB3ULL,0xDDF957BC36D8B9CAULL,0x64D0E29EEA8838B3ULL,0x08DD9BDFD96B9F63ULL,0x087E79E5A57D1D13ULL,0xE328E230E3E2B3FBULL,0x1C2559E30F0946BEULL,0x720BF5F26F4D2EAAULL,0xB0774D261CC609DBULL,0x443F64EC5A371195ULL,0x4112CF68649A260EULL,0xD813F2FAB7F5C5CAULL,0x660D3257380841EEULL,0x59AC2C7873F910A3ULL,0xE846963877671A17ULL,0x93B633ABFA3469F8ULL,0xC0C0F5A60EF4CDCFULL,0xCAF21ECD4377B28CULL,0x57277707199B8175ULL,0x506C11B9D90E8B1DULL,0xD83CC2687A19255FULL,0x4A29C6465A314CD1ULL,0xED2DF21216235097ULL,0xB5635C95FF7296E2ULL,0x22AF003AB672E811ULL,0x52E762596BF68235ULL,0x9AEBA33AC6ECC6B0ULL,0x944F6DE09134DFB6ULL,0x6C47BEC883A7DE39ULL,0x6AD047C430A12104ULL,0xA5B1CFDBA0AB4067ULL,0x7C45D833AFF07862ULL,0x5092EF950A16DA0BULL,0x9338E69C052B8E7BULL,0x455A4B4CFE30E3F5ULL,0x6B02E63195AD0CF8ULL,0x6B17B224BAD6BF27ULL,0xD1E0CCD25BB9C169ULL,0xDE0C89A556B9AE70ULL,0x50065E535A213CF6ULL,0x9C1169FA2777B874ULL,0x78EDEFD694AF1EEDULL,0x6DC93D9526A50E68ULL,0xEE97F453F06791EDULL,0x32AB0EDB696703D3ULL,0x3A6853C7E70757A7ULL,0x31865CED6120F37DULL,0x67FEF95D92607890ULL,0x1F2B1D1F15F6DC9CULL,0xB69E38A8965C6B65ULL,0xAA9119FF184CCCF4ULL,0xF43C732873F24C13ULL,0xFB4A3D794A9A80D2ULL,0x3550C2321FD6109CULL,0x371F77E76BB8417EULL,0x6BFA9AAE5EC05779ULL,0xCD04F3FF001A4778ULL,0xE3273522064480CAULL,0x9F91508BFFCFC14AULL,0x049A7F41061A9E60ULL,0xFCB6BE43A9F2FE9BULL,0x08DE8A1C7797DA9BULL,0x8F9887E6078735A1ULL,0xB5B4071DBFC73A66ULL,0x230E343DFBA08D33ULL,0x43ED7F5A0FAE657DULL,0x3A88A0FBBCB05C63ULL,0x21874B8B4D2DBC4FULL,0x1BDEA12E35F6A8C9ULL,0x53C065C6C8E63528ULL,0xE34A1D250E7A8D6BULL,0xD6B04D3B7651DD7EULL,0x5E90277E7CB39E2DULL,0x2C046F22062DC67DULL,0xB10BB459132D0A26ULL,0x3FA9DDFB67E2F199ULL,0x0E09B88E1914F7AFULL,0x10E8B35AF3EEAB37ULL,0x9EEDECA8E272B933ULL,0xD4C718BC4AE8AE5FULL,0x81536D601170FC20ULL,0x91B534F885818A06ULL,0xEC8177F83F900978ULL,0x190E714FADA5156EULL,0xB592BF39B0364963ULL,0x89C350C893AE7DC1ULL,0xAC042E70F8B383F2ULL,0xB49B52E587A1EE60ULL,0xFB152FE3FF26DA89ULL,0x3E666E6F69AE2C15ULL,0x3B544EBE544C19F9ULL,0xE805A1E290CF2456ULL,0x24B33C9D7ED25117ULL,0xE74733427B72F0C1ULL,0x0A804D18B7097475ULL,0x57E3306D881EDB4FULL,0x4AE7D6A36EB5DBCBULL,0x2D8D5432157064C8ULL,0xD1E649DE1E7F268BULL,0x8A328A1CEDFE552CULL,0x07A3AEC79624C7DAULL,0x84547DDC3E203C94ULL,0x990A98FD5071D263ULL,0x1A4FF12616EEFC89ULL,0xF6F7FD1431714200ULL,0x30C05B1BA332F41CULL,0x8D2636B81555A786ULL,0x46C9FEB55D120902ULL,0xCCEC0A73B49C9921ULL,0x4E9D2827355FC492ULL,0x19EBB029435DCB0FULL,0x4659D2B743848A2CULL,0x963EF2C96B33BE31ULL,0x74F85198B05A2E7DULL,0x5A0F544DD2B1FB18ULL,0x03727073C2E134B1ULL,0xC7F6AA2DE59AEA61ULL,0x352787BAA0D7C22FULL,0x9853EAB63B5E0B35ULL,0xABBDCDD7ED5C0860ULL,0xCF05DAF5AC8D77B0ULL,0x49CAD48CEBF4A71EULL,0x7A4C10EC2158C4A6ULL,0xD9E92AA246BF719EULL,0x13AE978D09FE5557ULL,0x730499AF921549FFULL,0x4E4B705B92903BA4ULL,0xFF577222C14F0A3AULL,0x55B6344CF97AAFAEULL,0xB862225B055B6960ULL,0xCAC09AFBDDD2CDB4ULL,0xDAF8E9829FE96B5FULL,0xB5FDFC5D3132C498ULL,0x310CB380DB6F7503ULL,0xE87FBB46217A360EULL,0x2102AE466EBB1148ULL,0xF8549E1A3AA5E00DULL,0x07A69AFDCC42261AULL,0xC4C118BFE78FEAAEULL,0xF9F4892ED96BD438ULL,0x1AF3DBE25D8F45DAULL,0xF5B4B0B0D2DEEEB4ULL,0x962ACEEFA82E1C84ULL,0x046E3ECAAF453CE9ULL,0xF05D129681949A4CULL,0x964781CE734B3C84ULL,0x9C2ED44081CE5FBDULL,0x522E23F3925E319EULL,0x177E00F9FC32F791ULL,0x2BC60A63A6F3B3F2ULL,0x222BBFAE61725606ULL,0x486289DDCC3D6780ULL,0x7DC7785B8EFDFC80ULL,0x8AF38731C02BA980ULL,0x1FAB64EA29A2DDF7ULL,0xE4D9429322CD065AULL,0x9DA058C67844F20CULL,0x24C0E332B70019B0ULL,0x233003B5A6CFE6ADULL,0xD586BD01C5C217F6ULL,0x5E5637885F29BC2BULL,0x7EBA726D8C94094BULL,0x0A56A5F0BFE39272ULL,0xD79476A84EE20D06ULL,0x9E4C1269BAA4BF37ULL,0x17EFEE45B0DEE640ULL,0x1D95B0A5FCF90BC6ULL,0x93CBE0B699C2585DULL,0x65FA4F227A2B6D79ULL,0xD5F9E858292504D5ULL,0xC2B5A03F71471A6FULL,0x59300222B4561E00ULL,0xCE2F8642CA0712DCULL,0x7CA9723FBB2E8988ULL,0x2785338347F2BA08ULL,0xC61BB3A141E50E8CULL,0x150F361DAB9DEC26ULL,0x9F6A419D382595F4ULL,0x64A53DC924FE7AC9ULL,0x142DE49FFF7A7C3DULL,0x0C335248857FA9E7ULL,0x0A9C32D5EAE45305ULL,0xE6C42178C4BBB92EULL,0x71F1CE2490D20B07ULL,0xF1BCC3D275AFE51AULL,0xE728E8C83C334074ULL,0x96FBF83A12884624ULL,0x81A1549FD6573DA5ULL,0x5FA7867CAF35E149ULL,0x56986E2EF3ED091BULL,0x917F1DD5F8886C61ULL,0xD20D8C88C8FFE65FULL,0x31D71DCE64B2C310ULL,0xF165B587DF898190ULL,0xA57E6339DD2CF3A0ULL,0x1EF6E6DBB1961EC9ULL,0x70CC73D90BC26E24ULL,0xE21A6B35DF0C3AD7ULL,0x003A93D8B2806962ULL,0x1C99DED33CB890A1ULL,0xCF3145DE0ADD4289ULL,0xD0E4427A5514FB72ULL,0x77C621CC9FB3A483ULL,0x67A34DAC4356550BULL,0xF8D626AAAF278509ULL,};
 const unsigned int TABLE_SZ = 1 << 22; // must be power of 2
+const unsigned int PERFT_TABLE_SZ = 1 << 20; // must be power of 2
+const unsigned int REP_FILTER_SZ = 1 << 12; // must be power of 2
+const unsigned int CUCKOO_SZ = 1 << 13; // must be power of 2
 
 /**
  * PST_OPENING/ENDGAME (Piece-Square Table)
@@ -155,9 +297,21 @@ struct TtableEntry
 {
     unsigned long long hash;
     short score;
-    short total_depth;
+    short draft; // remaining depth searched below this position
+    unsigned short age; // Engine::tt_age of the search that stored it
+    signed char move_sq_i, move_sq_f; // best move found, -1 if none
+
+    TtableEntry() : hash(0), score(0), draft(0), age(0), move_sq_i(-1), move_sq_f(-1)
+    {}
+};
 
-    TtableEntry() : hash(0), score(0), total_depth(0)
+struct PerftEntry
+{
+    unsigned long long hash;
+    unsigned long long cnt; // leaf positions depth plies below this position
+    short depth;
+
+    PerftEntry() : hash(0), cnt(0), depth(0)
     {}
 };
 
@@ -173,1371 +327,4797 @@ struct Moves
     {}
 };
 
-struct CastleRight {
-    bool castle_rights[MAX_PLAYER][2] = {{false, false}, {false, false}};
+/**
+ * Limits given by the UCI "go" command. 0 means not limited.
+ */
+struct SearchLimits
+{
+    short depth = MAX_DEPTH;
+    long long movetime = 0; // ms
+    long long time[MAX_PLAYER] = {0, 0}; // ms left on each player's clock
+    long long inc[MAX_PLAYER] = {0, 0}; // ms added to each player's clock per move
+    short movestogo = 0;
+    unsigned long long nodes = 0;
+    bool infinite = false;
+    bool ponder = false;
+};
 
-    inline bool (*data())[2]
+/**
+ * Counters of one search, collected only if compiled with SEARCH_STATS defined (e.g. /DSEARCH_STATS) and printed by the UCI command "stats".
+ * Otherwise the STAT() statements in Engine compile to nothing.
+ */
+#ifdef SEARCH_STATS
+struct SearchStats
+{
+    unsigned long long qs_nodes = 0;
+    unsigned long long tt_probes = 0, tt_hits = 0, tt_cutoffs = 0; // cutoff: child score taken from the entry instead of searched
+    unsigned long long nm_tries = 0, nm_cutoffs = 0;
+    unsigned long long beta_cutoffs = 0, first_move_cutoffs = 0;
+    unsigned long long legal = 0, illegal = 0; // results of will_check
+    unsigned long long iter_nodes[MAX_DEPTH + 1] = {0}; // Engine::nodes when each iteration of root_eval finished
+    short iter_cnt = 0;
+
+    void clear()
     {
-        return castle_rights;
+        *this = SearchStats();
     }
-    inline const bool (*data() const)[2]
+
+    void print(std::ostream &out, unsigned long long nodes) const
     {
-        return castle_rights;
+        auto percent = [](unsigned long long a, unsigned long long b)
+        {
+            return " (" + std::to_string(b ? a * 100 / b : 0) + "%)";
+        };
+        out << "info string nodes " << nodes << " qs_nodes " << qs_nodes << percent(qs_nodes, nodes) << '\n'
+            << "info string tt probes " << tt_probes << " hits " << tt_hits << percent(tt_hits, tt_probes)
+                << " cutoffs " << tt_cutoffs << percent(tt_cutoffs, tt_probes) << '\n'
+            << "info string null_move tries " << nm_tries << " cutoffs " << nm_cutoffs << percent(nm_cutoffs, nm_tries) << '\n'
+            << "info string beta_cutoffs " << beta_cutoffs << " first_move " << first_move_cutoffs << percent(first_move_cutoffs, beta_cutoffs) << '\n'
+            << "info string will_check legal " << legal << " illegal " << illegal << percent(illegal, legal + illegal) << '\n'
+            << "info string ebf";
+        for (short depth = 2; depth <= iter_cnt; depth++) // nodes of an iteration over nodes of the previous one, iter_nodes[0] = 0
+        {
+            unsigned long long prev = iter_nodes[depth-1] - iter_nodes[depth-2];
+            out << " depth " << depth << ' ' << std::fixed << std::setprecision(2)
+                << (prev ? double(iter_nodes[depth] - iter_nodes[depth-1]) / prev : 0.0);
+        }
+        out.unsetf(std::ios::fixed);
+        out << '\n';
     }
 };
+#define STAT(expr) (stats.expr)
+#else
+#define STAT(expr) ((void)0)
+#endif
 
-inline short x_of(short sq)
-{
-    return sq % WIDTH;
-}
-
-inline short y_of(short sq)
-{
-    return sq / WIDTH;
-}
+/**
+ * Hardware performance counters of bench, collected only on Linux if compiled with PERF_COUNTERS defined (e.g. -DPERF_COUNTERS).
+ * Each event is sampled: every sample_period events perf_event_open sends a signal, whose handler counts a sample for the current search_phase.
+ * PERF_PHASE(phase) sets search_phase until the end of the enclosing scope, and compiles to nothing otherwise.
+ */
+#if defined(PERF_COUNTERS) && defined(__linux__)
+enum SearchPhase: int {
+    PHASE_SEARCH = 0, // eval, QS_eval, move, unmove and everything not below
+    PHASE_MOVE_GEN = 1, PHASE_LEGALITY = 2, PHASE_TT = 3, PHASE_EVAL = 4,
+    MAX_SEARCH_PHASE = 5
+};
+const char *const SEARCH_PHASE_NAMES[MAX_SEARCH_PHASE] = { "search", "move_gen", "legality", "tt", "eval" };
 
-inline char file_of(short sq)
-{
-    return x_of(sq) + 'a';
-}
+thread_local volatile sig_atomic_t search_phase = PHASE_SEARCH;
 
-inline char rank_of(short sq)
+struct PerfPhaseScope
 {
-    return PLAY_WIDTH - y_of(sq) + '0';
-}
+    sig_atomic_t prev_phase;
 
-inline std::string LAN_of(Tag tag, short sq_i, short sq_f)
-{
-    std::string LAN = "";
-    LAN += file_of(sq_i);
-    LAN += rank_of(sq_i);
-    LAN += file_of(sq_f);
-    LAN += rank_of(sq_f);
-    if (tag <= IS_PROMO_Q)
-        LAN += char_of[0][tag]; // 0 = lowercase
-    return LAN;
-}
+    PerfPhaseScope(SearchPhase phase) : prev_phase(search_phase)
+    {
+        search_phase = phase;
+    }
+    ~PerfPhaseScope()
+    {
+        search_phase = prev_phase;
+    }
+};
+#define PERF_PHASE(phase) PerfPhaseScope perf_phase_scope(phase)
 
-inline bool is_play_area(short sq)
+struct PerfEvent
 {
-    return unsigned(sq) < AREA && x_of(sq) < PLAY_WIDTH; // if x < 0, it becomes a huge unsigned number > AREA.
-}
+    const char *name;
+    unsigned int type;
+    unsigned long long config;
+    unsigned long long sample_period;
+};
+const short MAX_PERF_EVENT = 5;
+const PerfEvent PERF_EVENTS[MAX_PERF_EVENT] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 200000},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 200000},
+    {"L1D_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), 5000},
+    {"LLC_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, 500},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 2000},
+};
 
 /**
- * @return the forward direction relative to the given player.
- * With BOT at the top and HUMAN at the bottom, BOT's forward = +WIDTH, HUMAN's forward = -WIDTH.
+ * Counters of the thread that called start(), until stop().
  */
-inline short rel_forward(Player player)
+struct PerfCounters
 {
-    return (player) ? -WIDTH : WIDTH;
-}
+    int fds[MAX_PERF_EVENT] = {-1, -1, -1, -1, -1};
+    volatile unsigned long long samples[MAX_PERF_EVENT][MAX_SEARCH_PHASE] = {{0}};
+    unsigned long long totals[MAX_PERF_EVENT] = {0};
+    std::string error = "";
 
-struct Engine
-{
-    friend std::ostream &operator<<(std::ostream& out, const Engine &engine)
+    static void on_overflow(int, siginfo_t *info, void *);
+
+    bool start()
     {
-        const std::string TAB = "   ";
-        out << "Transposition Table:" << std::endl;
-        short i = NULL;
-        for (const TtableEntry &entry : engine.ttable)
+        for (short i = 0; i < MAX_PERF_EVENT; i++) // from a previous run
         {
-            if (i < 10)
-            {
-                if (entry.hash)
-                {
-                    out << TAB << entry.hash << ", " << entry.score << ", " << entry.total_depth << std::endl;
-                    i++;
-                }
-            }
-            else
-                break;
+            for (short phase = 0; phase < MAX_SEARCH_PHASE; phase++)
+                samples[i][phase] = 0;
+            totals[i] = 0;
         }
-        out << TAB << "... (" << TABLE_SZ - 10 << " more)" << std::endl;
-
-        out << "hash:" << std::endl << TAB << engine.glob_hash << std::endl;
+        error.clear();
 
-        out << "Distance from endgame:" << std::endl << TAB << engine.phase << '/' << MAX_PHASE << std::endl;
+        struct sigaction action = {};
+        action.sa_sigaction = on_overflow;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigaction(SIGRTMIN, &action, nullptr);
 
-        out << "Worth as opening:" << std::endl;
-        for (short player = BOT; player <= HUMAN; player++)
+        f_owner_ex owner = {F_OWNER_TID, pid_t(syscall(SYS_gettid))};
+        for (short i = 0; i < MAX_PERF_EVENT; i++)
         {
-            out << TAB << '[' << (player ? "HUMAN" : "BOT") << "]=" << engine.psv_opening[player] << std::endl;
+            perf_event_attr attr = {};
+            attr.size = sizeof(attr);
+            attr.type = PERF_EVENTS[i].type;
+            attr.config = PERF_EVENTS[i].config;
+            attr.sample_period = PERF_EVENTS[i].sample_period;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)); // this thread, any cpu
+            if (fds[i] < 0)
+            {
+                error = std::string(PERF_EVENTS[i].name) + ": " + strerror(errno);
+                stop();
+                return false;
+            }
+            fcntl(fds[i], F_SETFL, O_ASYNC);
+            fcntl(fds[i], F_SETSIG, SIGRTMIN);
+            fcntl(fds[i], F_SETOWN_EX, &owner);
         }
-        out << "Worth as endgame:" << std::endl;
-        for (short player = BOT; player <= HUMAN; player++)
+        for (int fd : fds)
         {
-            out << TAB << '[' << (player ? "HUMAN" : "BOT") << "]=" << engine.psv_endgame[player] << std::endl;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_REFRESH, 1); // enable until the next overflow, re-armed by on_overflow
         }
+        return true;
+    }
 
-        out << "FEN:" << std::endl << TAB;
-        short count = 0;
-        for (short sq = 0; sq < AREA; sq++)
+    void stop()
+    {
+        for (short i = 0; i < MAX_PERF_EVENT; i++)
         {
-            if (x_of(sq) == PLAY_WIDTH)
-            {
-                if (count)
-                {
-                    out << count;
-                    count = 0;
-                }
-                if (sq != AREA - SENTL_WIDTH)
-                    out << '/';
-                sq++; // skip col 9
-            }
-            else
+            if (fds[i] >= 0)
             {
-                Piece *piece = engine.squares[sq];
-                if (piece)
-                {
-                    if (count)
-                    {
-                        out << count;
-                        count = 0;
-                    }
-                    out << char_of[piece->player][piece->shape];
-                }
-                else
-                    count++;
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fds[i], &totals[i], sizeof(totals[i])) != sizeof(totals[i]))
+                    totals[i] = 0;
+                close(fds[i]);
             }
+            fds[i] = -1;
         }
-        out << ' ' << (engine.glob_player ? 'w' : 'b') << ' ';
-        for (short player = HUMAN; player >= BOT; player--)
-            for (short side = Q_SIDE; side <= K_SIDE; side++)
-                if (engine.glob_castle_rights.data()[player][side])
-                    out << char_of[player][KING - side];
-        out << std::endl;
+    }
 
-        out << TAB << "+-------------BOT-------------+" << std::endl;
-        for (short sq = 0; sq < AREA; sq++)
+    /**
+     * Print the total of each event and its estimated split between search phases, by share of samples.
+     */
+    void report(std::ostream &out) const
+    {
+        if (!error.empty())
         {
-            if (!is_play_area(sq)) // sentinels
-            {
-                out << " . . | " << std::endl;
-                sq++; // skip col 9
-            }
-            else
-            {
-                if (x_of(sq) == 0)
-                    out << std::setw(2) << rank_of(sq) << " |";
+            out << "Perf counters unavailable: " << error << '\n';
+            return;
+        }
+        out << '\n' << std::left << std::setw(16) << "Perf counters" << std::right << std::setw(16) << "total";
+        for (const char *name : SEARCH_PHASE_NAMES)
+            out << std::setw(12) << name;
+        out << '\n';
 
-                Piece *piece = engine.squares[sq];
-                if (piece)
-                    out << std::setw(3) << char_of[piece->player][piece->shape];
-                else
-                    out << std::setw(3) << '_';
-            }
+        for (short i = 0; i < MAX_PERF_EVENT; i++)
+        {
+            unsigned long long sample_cnt = 0;
+            for (short phase = 0; phase < MAX_SEARCH_PHASE; phase++)
+                sample_cnt += samples[i][phase];
+
+            out << std::left << std::setw(16) << PERF_EVENTS[i].name << std::right << std::setw(16) << totals[i];
+            for (short phase = 0; phase < MAX_SEARCH_PHASE; phase++)
+                out << std::setw(11) << (sample_cnt ? samples[i][phase] * 100 / sample_cnt : 0) << '%';
+            out << '\n';
         }
-        out << TAB << "+-------------YOU-------------+" << std::endl << TAB << ' ';
-        for (short i = 0; i < PLAY_WIDTH; i++)
-            out << std::setw(3) << file_of(i);
-        out << std::endl;
-        return out;
+        out << "IPC: " << std::fixed << std::setprecision(2) << (totals[0] ? double(totals[1]) / totals[0] : 0.0) << '\n';
+        out.unsetf(std::ios::fixed);
     }
+} perf_counters;
 
-    class MVVLVAMoveGenerator
+void PerfCounters::on_overflow(int, siginfo_t *info, void *)
+{
+    for (short i = 0; i < MAX_PERF_EVENT; i++)
     {
-        public:
-            MVVLVAMoveGenerator(const Engine &engine_, Player player, const bool is_QS_, const bool castle_rights_[2]) : engine(engine_), is_QS(is_QS_), castle_rights(castle_rights_)
-            {
-                gen_MVVLVA_moves(player);
-            }
+        if (perf_counters.fds[i] == info->si_fd)
+        {
+            perf_counters.samples[i][search_phase]++;
+            ioctl(info->si_fd, PERF_EVENT_IOC_REFRESH, 1);
+        }
+    }
+}
+#else
+#define PERF_PHASE(phase) ((void)0)
+#endif
 
-            /**
-             * @return whether moves[] has element remaining.
-             */
-            inline Moves *next()
-            {
-                while (i_v < KING)
-                {
-                    while (i_a < MAX_SHAPE)
-                    {
-                        if (i < moves_end[i_v][i_a])
-                            return &moves[i_v][i_a][i++];
+inline long long now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-                        i = 0;
-                        i_a++;
-                    }
-                    i_a = 0;
-                    i_v++;
-                }
-                if (i < quiet_moves.size())
-                    return &quiet_moves[i++];
+inline long long now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-                return nullptr;
-            };
+const unsigned int TRACE_SZ = 1 << 16; // must be power of 2
 
-        private:
-            const Engine &engine;
-            const bool is_QS, *castle_rights;
+struct TraceEvent
+{
+    const char *name;
+    long long ts, dur; // us
+    int tid;
+    short depth; // -1 if none
+    char move[6]; // LAN, "" if none
+};
 
-            /**
-             * moves
-             * └── victims ordered from most to least valuable: QUEEN, ..., PAWN (KING cannot be captured)
-             *     └── attackers ordered from least to most valuable: PAWN, ..., KING
-             *         └── see struct Moves{}
-             * 
-             * quiet_moves - see struct Moves{}
-             */
-            Moves moves[KING][MAX_SHAPE][MAX_VCTM_CNT] = {{{}}};
-            short moves_end[KING][MAX_SHAPE] = {{0}}, i_v = 0, i_a = 0, i = 0, sq_i = NULL, sq_f = NULL;
-            Shape shape_a;
-            std::vector<Moves> quiet_moves;
+/**
+ * Timeline of the search, enabled by the UCI option TraceFile and written there as Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+ * after each search or perft.
+ * Any thread may record: a slot of the ring buffer events[] is claimed by incrementing next, so the oldest events are overwritten first.
+ */
+struct Tracer
+{
+    std::atomic<bool> is_enabled{false};
+    std::string path = "";
+    TraceEvent events[TRACE_SZ];
+    std::atomic<unsigned long long> next{0};
+    std::atomic<int> thread_cnt{0};
 
-            inline void MVVLVA_insert(Tag tag, Shape shape_v, Piece *ptr_v)
-            {
-                if (!is_QS || shape_v != PAWN)
-                {
-                    short i_v = QUEEN - shape_v;
+    inline int tid()
+    {
+        thread_local int tid = ++thread_cnt;
+        return tid;
+    }
 
-                    if (moves_end[i_v][shape_a] >= MAX_VCTM_CNT)
-                        std::clog << "Error: moves[] array overflowed! Please contact developer." << std::endl;
+    inline void record(const char *name, long long ts, short depth, const char *move)
+    {
+        TraceEvent &event = events[next.fetch_add(1, std::memory_order_relaxed) & (TRACE_SZ - 1)];
+        event.name = name;
+        event.ts = ts;
+        event.dur = now_us() - ts;
+        event.tid = tid();
+        event.depth = depth;
+        std::snprintf(event.move, sizeof(event.move), "%s", move);
+    }
 
-                    moves[i_v][shape_a][moves_end[i_v][shape_a]++] = {tag, shape_a, sq_i, sq_f, ptr_v};
-                }
-            }
-            inline void quiet_push()
-            {
-                if (!is_QS)
-                    quiet_moves.emplace_back(IS_NORM, shape_a, sq_i, sq_f, nullptr);
-            }
+    /**
+     * Write the recorded events to path and clear them. Must not run while other threads record.
+     */
+    void dump()
+    {
+        unsigned long long end = next.exchange(0), begin = (end > TRACE_SZ) ? end - TRACE_SZ : 0;
+        std::ofstream out(path);
+        if (!out)
+            return;
+
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << '\n';
+        for (unsigned long long i = begin; i < end; i++)
+        {
+            const TraceEvent &event = events[i & (TRACE_SZ - 1)];
+            out << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.tid
+                << ", \"ts\": " << event.ts << ", \"dur\": " << event.dur << ", \"args\": {";
+            if (event.depth >= 0)
+                out << "\"depth\": " << event.depth << (event.move[0] ? ", " : "");
+            if (event.move[0])
+                out << "\"move\": \"" << event.move << "\"";
+            out << "}}" << (i + 1 < end ? "," : "") << '\n';
+        }
+        out << "]}" << '\n';
+    }
+} tracer;
+
+/**
+ * Why a node of the search tree returned, see struct TreeRecord.
+ */
+enum TreeReason: unsigned char {
+    TREE_ALL = 0, // every move searched without cutoff
+    TREE_BETA_CUTOFF = 1,
+    TREE_NULL_MOVE = 2,
+    TREE_MATE_DISTANCE = 3,
+    TREE_UPCOMING_REP = 4,
+    TREE_TT = 5, // score taken from the transposition table by the parent, not searched
+    TREE_REPETITION = 6, // draw by repetition detected by the parent, not searched
+    TREE_STAND_PAT = 7,
+    TREE_MATE = 8, // checkmate or stalemate
+    TREE_ITERATION = 9, // root, written after each iteration of root_eval with draft = iteration depth
+    MAX_TREE_REASON = 10
+};
+const char *const TREE_REASON_NAMES[MAX_TREE_REASON] = {
+    "all", "beta_cutoff", "null_move", "mate_distance", "upcoming_rep", "tt", "repetition", "stand_pat", "mate", "iteration"
+};
+
+/**
+ * One node of the search tree, written when the node returns (children before their parent).
+ * A file starts with a TreeHeader followed by the records.
+ */
+struct TreeRecord
+{
+    unsigned long long hash;
+    short alpha, beta; // window on entry
+    short score; // returned
+    unsigned char ply;
+    signed char draft; // remaining depth, 0 in QS_eval
+    signed char sq_i, sq_f; // best or cutoff move, -1 if none
+    TreeReason reason;
+    unsigned char reserved[5];
+};
+static_assert(sizeof(TreeRecord) == 24, "TreeRecord is a file format");
+
+struct TreeHeader
+{
+    char magic[8]; // TREE_MAGIC
+    unsigned int record_sz;
+    unsigned int reserved;
+};
+const char TREE_MAGIC[8] = {'S', 'G', '4', 'T', 'R', 'E', 'E', '1'};
+const size_t TREE_CHUNK = 1 << 20; // records the file grows by when full
+
+/**
+ * Appends TreeRecords to a memory-mapped file, enabled by the UCI option TreeFile.
+ * The mapping doubles when full and the file is truncated to the records written on close().
+ */
+struct TreeWriter
+{
+    std::string path = "";
+    size_t size = 0, capacity = 0; // records
+
+    ~TreeWriter()
+    {
+        close();
+    }
+
+    inline bool is_open() const
+    {
+        return base;
+    }
+
+    bool open()
+    {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+#else
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+#endif
+        if (!map(TREE_CHUNK))
+        {
+            close();
+            return false;
+        }
+        TreeHeader *header = reinterpret_cast<TreeHeader *>(base);
+        std::copy(TREE_MAGIC, TREE_MAGIC + 8, header->magic);
+        header->record_sz = sizeof(TreeRecord);
+        header->reserved = 0;
+        return true;
+    }
+
+    inline void write(const TreeRecord &record)
+    {
+        if (size == capacity && !map(capacity * 2))
+            return;
+        records[size++] = record;
+    }
+
+    void close()
+    {
+        size_t bytes = sizeof(TreeHeader) + size * sizeof(TreeRecord);
+#ifdef _WIN32
+        if (base)
+            UnmapViewOfFile(base);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            LARGE_INTEGER end;
+            end.QuadPart = LONGLONG(bytes);
+            SetFilePointerEx(file, end, nullptr, FILE_BEGIN);
+            SetEndOfFile(file);
+            CloseHandle(file);
+        }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (base)
+            munmap(base, sizeof(TreeHeader) + capacity * sizeof(TreeRecord));
+        if (fd >= 0)
+        {
+            if (ftruncate(fd, off_t(bytes)))
+                LOG(LOG_ERROR, "could not truncate " << path);
+            ::close(fd);
+        }
+        fd = -1;
+#endif
+        base = nullptr;
+        records = nullptr;
+        size = 0;
+        capacity = 0;
+    }
+
+    private:
+        char *base = nullptr;
+        TreeRecord *records = nullptr;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#else
+        int fd = -1;
+#endif
+
+        /**
+         * Grow the file to new_capacity records and map it again.
+         */
+        bool map(size_t new_capacity)
+        {
+            size_t bytes = sizeof(TreeHeader) + new_capacity * sizeof(TreeRecord);
+#ifdef _WIN32
+            if (base)
+                UnmapViewOfFile(base);
+            if (mapping)
+                CloseHandle(mapping);
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, DWORD(bytes >> 32), DWORD(bytes), nullptr);
+            base = mapping ? static_cast<char *>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, bytes)) : nullptr;
+#else
+            if (base)
+                munmap(base, sizeof(TreeHeader) + capacity * sizeof(TreeRecord));
+            void *addr = ftruncate(fd, off_t(bytes)) ? MAP_FAILED : mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            base = (addr == MAP_FAILED) ? nullptr : static_cast<char *>(addr);
+#endif
+            if (!base) // stop recording, the records written so far are kept by close()
+            {
+                records = nullptr;
+                capacity = size;
+                return false;
+            }
+            records = reinterpret_cast<TreeRecord *>(base + sizeof(TreeHeader));
+            capacity = new_capacity;
+            return true;
+        }
+};
+
+/**
+ * A file mapped read-only, e.g. a PGN: pages are read from disk on first access, so the file is never loaded whole.
+ * data is nullptr if the file is empty or not open.
+ * is_sequential hints the OS to read ahead, otherwise (e.g. for binary search) to read only the pages touched.
+ */
+struct MappedFile
+{
+    const char *data = nullptr;
+    size_t size = 0;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    bool open(const std::string &path, bool is_sequential = true)
+    {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           is_sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, nullptr);
+        LARGE_INTEGER bytes;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &bytes))
+        {
+            close();
+            return false;
+        }
+        size = size_t(bytes.QuadPart);
+        if (size)
+        {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            data = mapping ? static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+        }
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        off_t bytes = (fd < 0) ? -1 : lseek(fd, 0, SEEK_END);
+        if (bytes < 0)
+        {
+            close();
+            return false;
+        }
+        size = size_t(bytes);
+        if (size)
+        {
+            void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            data = (addr == MAP_FAILED) ? nullptr : static_cast<const char *>(addr);
+            if (data)
+                madvise(addr, size, is_sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+        }
+#endif
+        if (size && !data)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            munmap(const_cast<char *>(data), size);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    private:
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#else
+        int fd = -1;
+#endif
+};
+
+const size_t BOOK_ENTRY_SZ = 16; // bytes of a Polyglot entry: key (8), move (2), weight (2), learn (4), big-endian
+
+/**
+ * @return the big-endian unsigned integer of n bytes.
+ */
+inline unsigned long long big_endian_of(const char *bytes, short n)
+{
+    unsigned long long value = 0;
+    for (short i = 0; i < n; i++)
+        value = value << 8 | (unsigned char)(bytes[i]);
+    return value;
+}
+
+/**
+ * Polyglot opening book (.bin), enabled by the UCI options OwnBook and BookFile, see Engine::book_move().
+ * Its entries are sorted by key, so the mapped file is binary-searched in place and only the pages touched are read.
+ * move: to file | to row << 3 | from file << 6 | from row << 9 | promoted shape (1 knight...4 queen) << 12, castling is the king taking its rook.
+ */
+struct Book
+{
+    std::string path;
+    bool is_enabled = false;
+    MappedFile file;
+
+    bool open()
+    {
+        if (!file.open(path, false) || file.size % BOOK_ENTRY_SZ)
+        {
+            file.close();
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const
+    {
+        return file.data ? file.size / BOOK_ENTRY_SZ : 0;
+    }
+
+    unsigned long long key_at(size_t i) const
+    {
+        return big_endian_of(file.data + i*BOOK_ENTRY_SZ, 8);
+    }
+
+    unsigned short move_at(size_t i) const
+    {
+        return (unsigned short)(big_endian_of(file.data + i*BOOK_ENTRY_SZ + 8, 2));
+    }
+
+    unsigned short weight_at(size_t i) const
+    {
+        return (unsigned short)(big_endian_of(file.data + i*BOOK_ENTRY_SZ + 10, 2));
+    }
+
+    /**
+     * @return index of the first entry of key, or of the first greater key.
+     */
+    size_t find(unsigned long long key) const
+    {
+        size_t lo = 0, hi = size();
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            if (key_at(mid) < key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+};
+
+/**
+ * Records a complete event from its construction to the end of the enclosing scope, if tracing is enabled.
+ */
+struct TraceScope
+{
+    const char *name;
+    long long ts;
+    short depth;
+    std::string move;
+
+    TraceScope(const char *name_, short depth_ = -1, std::string move_ = "") : name(name_), ts(-1), depth(depth_), move(move_)
+    {
+        if (tracer.is_enabled.load(std::memory_order_relaxed))
+            ts = now_us();
+    }
+    ~TraceScope()
+    {
+        if (ts >= 0)
+            tracer.record(name, ts, depth, move.c_str());
+    }
+};
+
+struct HistoryEntry
+{
+    unsigned long long hash;
+    short rev_cnt; // plies since the last irreversible move (capture, pawn move, castle, loss of castle right)
+};
+
+struct RootMove
+{
+    Moves move;
+    short score = 0;
+    short line_len = 0; // 0 if score is only a bound
+    Moves line[MAX_PLY + 1]; // principal variation, starting with move
+
+    RootMove(const Moves &move_ = Moves()) : move(move_)
+    {}
+};
+
+struct CastleRight {
+    bool castle_rights[MAX_PLAYER][2] = {{false, false}, {false, false}};
+
+    inline bool operator==(const CastleRight &other) const
+    {
+        return std::equal(&castle_rights[0][0], &castle_rights[0][0] + MAX_PLAYER*2, &other.castle_rights[0][0]);
+    }
+
+    inline bool (*data())[2]
+    {
+        return castle_rights;
+    }
+    inline const bool (*data() const)[2]
+    {
+        return castle_rights;
+    }
+};
+
+inline short x_of(short sq)
+{
+    return sq % WIDTH;
+}
+
+inline short y_of(short sq)
+{
+    return sq / WIDTH;
+}
+
+inline char file_of(short sq)
+{
+    return x_of(sq) + 'a';
+}
+
+inline char rank_of(short sq)
+{
+    return PLAY_WIDTH - y_of(sq) + '0';
+}
+
+inline std::string LAN_of(Tag tag, short sq_i, short sq_f)
+{
+    std::string LAN = "";
+    LAN += file_of(sq_i);
+    LAN += rank_of(sq_i);
+    LAN += file_of(sq_f);
+    LAN += rank_of(sq_f);
+    if (tag <= IS_PROMO_Q)
+        LAN += char_of[0][tag]; // 0 = lowercase
+    return LAN;
+}
+
+/**
+ * @return the UCI score ("cp x" or "mate y") of a minimax score, seen from the given player.
+ */
+inline std::string UCI_score_of(short score, Player player)
+{
+    if (score >= SHRT_MAX - MAX_PLY || score <= SHRT_MIN + MAX_PLY) // someone is checkmated n plies from root
+    {
+        short n = (score > 0) ? SHRT_MAX - score : score - SHRT_MIN;
+        bool is_winner = (score > 0) == (player == MAXER);
+        return "mate " + std::to_string(is_winner ? (n + 1) / 2 : -(n / 2));
+    }
+    return "cp " + std::to_string(player == MAXER ? score : -score);
+}
+
+inline bool is_play_area(short sq)
+{
+    return unsigned(sq) < AREA && x_of(sq) < PLAY_WIDTH; // if x < 0, it becomes a huge unsigned number > AREA.
+}
+
+/**
+ * @return the forward direction relative to the given player.
+ * With BOT at the top and HUMAN at the bottom, BOT's forward = +WIDTH, HUMAN's forward = -WIDTH.
+ */
+inline short rel_forward(Player player)
+{
+    return (player) ? -WIDTH : WIDTH;
+}
+
+/**
+ * CUCKOO (Cuckoo Table of reversible moves)
+ * └── 0...CUCKOO_SZ-1: ZTABLE[player][shape][sq_a] ^ ZTABLE[player][shape][sq_b] ^ ZPLAYER, for every KNIGHT...KING move
+ *     between sq_a and sq_b on an empty board, else 0. Each key is stored at cuckoo_h1(key) or cuckoo_h2(key).
+ * CUCKOO_SQ: the {sq_a, sq_b} of each key
+ *
+ * Filled once at startup by init_cuckoo(). Method from Marcel van Kervinck: http://www.open-chess.org/viewtopic.php?f=5&t=2300
+ */
+unsigned long long CUCKOO[CUCKOO_SZ];
+short CUCKOO_SQ[CUCKOO_SZ][2];
+
+inline unsigned int cuckoo_h1(unsigned long long key)
+{
+    return key & (CUCKOO_SZ - 1);
+}
+
+inline unsigned int cuckoo_h2(unsigned long long key)
+{
+    return (key >> 16) & (CUCKOO_SZ - 1);
+}
+
+/**
+ * @return whether the shape can move from sq_a to sq_b on an empty board.
+ */
+inline bool is_pseudo_attack(Shape shape, short sq_a, short sq_b)
+{
+    short dx = abs(x_of(sq_a) - x_of(sq_b)),
+          dy = abs(y_of(sq_a) - y_of(sq_b));
+    switch (shape)
+    {
+        case KNIGHT:
+            return (dx == 1 && dy == 2) || (dx == 2 && dy == 1);
+        case BISHOP:
+            return dx == dy;
+        case ROOK:
+            return dx == 0 || dy == 0;
+        case QUEEN:
+            return dx == dy || dx == 0 || dy == 0;
+        case KING:
+            return std::max(dx, dy) == 1;
+        default:
+            return false;
+    }
+}
+
+bool init_cuckoo()
+{
+    for (short player = BOT; player <= HUMAN; player++)
+    {
+        for (short shape = KNIGHT; shape <= KING; shape++)
+        {
+            for (short sq_a = 0; sq_a < AREA; sq_a++)
+            {
+                for (short sq_b = sq_a + 1; sq_b < AREA; sq_b++)
+                {
+                    if (!is_play_area(sq_a) || !is_play_area(sq_b) || !is_pseudo_attack(Shape(shape), sq_a, sq_b))
+                        continue;
+
+                    unsigned long long key = ZTABLE[player][shape][sq_a] ^ ZTABLE[player][shape][sq_b] ^ ZPLAYER;
+                    short sq[2] = {sq_a, sq_b};
+                    unsigned int i = cuckoo_h1(key);
+                    while (true) // insert, kicking the occupant to its other slot until an empty slot is found
+                    {
+                        std::swap(CUCKOO[i], key);
+                        std::swap(CUCKOO_SQ[i][0], sq[0]);
+                        std::swap(CUCKOO_SQ[i][1], sq[1]);
+                        if (!key)
+                            break;
+                        i = (i == cuckoo_h1(key)) ? cuckoo_h2(key) : cuckoo_h1(key);
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+const bool IS_CUCKOO_INIT = init_cuckoo();
+
+/**
+ * @return the next space-separated token of rest, which is advanced past it. Empty if none is left.
+ */
+inline std::string_view next_token(std::string_view &rest)
+{
+    size_t begin = rest.find_first_not_of(' ');
+    if (begin == std::string_view::npos)
+    {
+        rest = {};
+        return {};
+    }
+    size_t end = std::min(rest.find(' ', begin), rest.size());
+    std::string_view token = rest.substr(begin, end - begin);
+    rest.remove_prefix(end);
+    return token;
+}
+
+/**
+ * @return index of the lowest set bit of bits, which must not be 0.
+ */
+inline short lowest_bit_of(unsigned long long bits)
+{
+#ifdef _MSC_VER
+    unsigned long i = 0;
+    _BitScanForward64(&i, bits);
+    return short(i);
+#else
+    return short(__builtin_ctzll(bits));
+#endif
+}
+
+/**
+ * The pieces of a position in 24 bytes.
+ * occupancy: bit y*PLAY_WIDTH + x is set if squares[y*WIDTH + x] holds a piece (y = 0 is rank 8).
+ * nibbles: the pieces in the order of their bits in occupancy, 2 per byte (low nibble first), each player << 3 | shape.
+ */
+struct PackedBoard
+{
+    unsigned long long occupancy;
+    unsigned char nibbles[16];
+};
+
+/**
+ * A position in 32 bytes, converted from and to FEN by parse_FEN() and FEN_of(), and from and to an Engine by Engine::pack() and Engine::load().
+ */
+struct PackedPosition
+{
+    PackedBoard board;
+    unsigned char flags; // PACKED_WHITE_TO_MOVE | PACKED_CASTLE[player][side]
+    signed char ep_x; // column of the en passant target square, -1 if none
+    unsigned short rev_cnt; // halfmove clock
+    unsigned short fullmove;
+    unsigned char reserved[2];
+};
+static_assert(sizeof(PackedPosition) == 32, "PackedPosition is a file format");
+
+const unsigned char PACKED_WHITE_TO_MOVE = 1,
+                    PACKED_CASTLE[MAX_PLAYER][2] = {{1 << 4, 1 << 3}, {1 << 2, 1 << 1}};
+const short PACKED_MAX_PIECES = 16; // per player, as in a legal position
+
+/**
+ * Validate FEN and pack it into pos in one pass. Fields after the side to move may be omitted (default "- - 0 1").
+ * Castle rights whose king and rook are not on their initial squares are dropped, and may be given as in Shredder-FEN (e.g. "HAha").
+ * @return false if FEN is not 8 ranks of 8 squares with one king and at most PACKED_MAX_PIECES per player and no pawn on rank 1 or 8,
+ * followed by side to move, castle rights, en passant target square and move counters.
+ */
+bool parse_FEN(std::string_view FEN, PackedPosition &pos)
+{
+    pos = PackedPosition();
+    pos.ep_x = -1;
+    pos.fullmove = 1;
+    signed char nibble_of[PLAY_WIDTH * PLAY_WIDTH]; // by bit of occupancy, -1 if empty
+    std::fill(std::begin(nibble_of), std::end(nibble_of), -1);
+    short x = 0, y = 0, n = 0, piece_cnt[MAX_PLAYER] = {0, 0}, king_cnt[MAX_PLAYER] = {0, 0};
+    size_t i = 0;
+
+    // FEN field 1
+    for (; i < FEN.size() && FEN[i] != ' '; i++)
+    {
+        char ch = FEN[i];
+        if (ch == '/')
+        {
+            if (x != PLAY_WIDTH || ++y >= PLAY_WIDTH)
+                return false;
+            x = 0;
+        }
+        else if ('1' <= ch && ch <= '8')
+        {
+            x += ch - '0';
+            if (x > PLAY_WIDTH)
+                return false;
+        }
+        else
+        {
+            Shape shape;
+            switch (ch | 0x20) // lowercase
+            {
+                case 'p':
+                    shape = PAWN;
+                    break;
+                case 'n':
+                    shape = KNIGHT;
+                    break;
+                case 'b':
+                    shape = BISHOP;
+                    break;
+                case 'r':
+                    shape = ROOK;
+                    break;
+                case 'q':
+                    shape = QUEEN;
+                    break;
+                case 'k':
+                    shape = KING;
+                    break;
+                default:
+                    return false;
+            }
+            Player player = Player(ch < 'a'); // uppercase
+            if (x >= PLAY_WIDTH || ++piece_cnt[player] > PACKED_MAX_PIECES ||
+                (shape == PAWN && (y == 0 || y == PLAY_WIDTH - 1)))
+                return false;
+            king_cnt[player] += (shape == KING);
+            nibble_of[y*PLAY_WIDTH + x] = (signed char)(player << 3 | shape);
+            pos.board.occupancy |= 1ull << (y*PLAY_WIDTH + x);
+            pos.board.nibbles[n / 2] |= (player << 3 | shape) << (n % 2 * 4);
+            n++;
+            x++;
+        }
+    }
+    if (y != PLAY_WIDTH - 1 || x != PLAY_WIDTH || king_cnt[BOT] != 1 || king_cnt[HUMAN] != 1)
+        return false;
+
+    // FEN fields 2-6
+    std::string_view rest = FEN.substr(i), side = next_token(rest), castle = next_token(rest), ep = next_token(rest),
+                     rev_cnt = next_token(rest), fullmove = next_token(rest);
+    if (side != "w" && side != "b")
+        return false;
+    pos.flags = (side == "w") ? PACKED_WHITE_TO_MOVE : 0;
+
+    if (castle.size() > 4)
+        return false;
+    for (char ch : castle)
+    {
+        if (castle == "-")
+            break;
+        Player player = Player(bool(isupper(ch)));
+        char right = char(toupper(ch));
+        Side castle_side = (right == 'K' || right == 'H') ? K_SIDE : Q_SIDE; // Shredder-FEN names the rook's file
+        if (right != 'K' && right != 'Q' && right != 'H' && right != 'A')
+            return false;
+        short y_home = (player == HUMAN) ? PLAY_WIDTH - 1 : 0, x_rook = x_of(R_SQ_CASTLE[player][castle_side]);
+        if (nibble_of[y_home*PLAY_WIDTH + 4] == (player << 3 | KING) && nibble_of[y_home*PLAY_WIDTH + x_rook] == (player << 3 | ROOK))
+            pos.flags |= PACKED_CASTLE[player][castle_side];
+    }
+
+    if (!ep.empty() && ep != "-")
+    {
+        if (ep.size() != 2 || ep[0] < 'a' || ep[0] > 'h' || ep[1] != ((side == "w") ? '6' : '3'))
+            return false;
+        pos.ep_x = (signed char)(ep[0] - 'a');
+    }
+
+    if (!rev_cnt.empty() && std::from_chars(rev_cnt.data(), rev_cnt.data() + rev_cnt.size(), pos.rev_cnt).ec != std::errc())
+        return false;
+    if (!fullmove.empty() && std::from_chars(fullmove.data(), fullmove.data() + fullmove.size(), pos.fullmove).ec != std::errc())
+        return false;
+    pos.fullmove = std::max(pos.fullmove, (unsigned short)1);
+    return next_token(rest).empty();
+}
+
+/**
+ * @return FEN of pos.
+ */
+std::string FEN_of(const PackedPosition &pos)
+{
+    std::string FEN = "";
+    FEN.reserve(96);
+    short n = 0, empty_cnt = 0;
+    for (short y = 0; y < PLAY_WIDTH; y++)
+    {
+        for (short x = 0; x < PLAY_WIDTH; x++)
+        {
+            if (!(pos.board.occupancy >> (y*PLAY_WIDTH + x) & 1))
+                empty_cnt++;
+            else
+            {
+                if (empty_cnt)
+                    FEN += char('0' + empty_cnt);
+                empty_cnt = 0;
+                short nibble = pos.board.nibbles[n / 2] >> (n % 2 * 4) & 0xF;
+                FEN += char_of[nibble >> 3][std::min(nibble & 7, KING + 0)];
+                n++;
+            }
+        }
+        if (empty_cnt)
+            FEN += char('0' + empty_cnt);
+        empty_cnt = 0;
+        if (y < PLAY_WIDTH - 1)
+            FEN += '/';
+    }
+
+    FEN += (pos.flags & PACKED_WHITE_TO_MOVE) ? " w " : " b ";
+    size_t castle_at = FEN.size();
+    if (pos.flags & PACKED_CASTLE[HUMAN][K_SIDE])
+        FEN += 'K';
+    if (pos.flags & PACKED_CASTLE[HUMAN][Q_SIDE])
+        FEN += 'Q';
+    if (pos.flags & PACKED_CASTLE[BOT][K_SIDE])
+        FEN += 'k';
+    if (pos.flags & PACKED_CASTLE[BOT][Q_SIDE])
+        FEN += 'q';
+    if (FEN.size() == castle_at)
+        FEN += '-';
+
+    FEN += ' ';
+    if (pos.ep_x < 0)
+        FEN += '-';
+    else
+    {
+        FEN += char('a' + pos.ep_x);
+        FEN += (pos.flags & PACKED_WHITE_TO_MOVE) ? '6' : '3';
+    }
+    FEN += ' ';
+    FEN += std::to_string(pos.rev_cnt);
+    FEN += ' ';
+    FEN += std::to_string(pos.fullmove);
+    return FEN;
+}
+
+struct Engine
+{
+    friend std::ostream &operator<<(std::ostream& out, const Engine &engine)
+    {
+        const std::string TAB = "   ";
+        out << "Transposition Table:" << '\n';
+        short i = NULL;
+        for (const TtableEntry &entry : engine.ttable)
+        {
+            if (i < 10)
+            {
+                if (entry.hash)
+                {
+                    out << TAB << entry.hash << ", " << entry.score << ", " << entry.draft << '\n';
+                    i++;
+                }
+            }
+            else
+                break;
+        }
+        out << TAB << "... (" << engine.ttable.size() - 10 << " more)" << '\n';
+
+        out << "hash:" << '\n' << TAB << engine.glob_hash << '\n';
+
+        out << "Distance from endgame:" << '\n' << TAB << engine.phase << '/' << MAX_PHASE << '\n';
+
+        out << "Worth as opening:" << '\n';
+        for (short player = BOT; player <= HUMAN; player++)
+        {
+            out << TAB << '[' << (player ? "HUMAN" : "BOT") << "]=" << engine.psv_opening[player] << '\n';
+        }
+        out << "Worth as endgame:" << '\n';
+        for (short player = BOT; player <= HUMAN; player++)
+        {
+            out << TAB << '[' << (player ? "HUMAN" : "BOT") << "]=" << engine.psv_endgame[player] << '\n';
+        }
+
+        out << "FEN:" << '\n' << TAB;
+        short count = 0;
+        for (short sq = 0; sq < AREA; sq++)
+        {
+            if (x_of(sq) == PLAY_WIDTH)
+            {
+                if (count)
+                {
+                    out << count;
+                    count = 0;
+                }
+                if (sq != AREA - SENTL_WIDTH)
+                    out << '/';
+                sq++; // skip col 9
+            }
+            else
+            {
+                Piece *piece = engine.squares[sq];
+                if (piece)
+                {
+                    if (count)
+                    {
+                        out << count;
+                        count = 0;
+                    }
+                    out << char_of[piece->player][piece->shape];
+                }
+                else
+                    count++;
+            }
+        }
+        out << ' ' << (engine.glob_player ? 'w' : 'b') << ' ';
+        for (short player = HUMAN; player >= BOT; player--)
+            for (short side = Q_SIDE; side <= K_SIDE; side++)
+                if (engine.glob_castle_rights.data()[player][side])
+                    out << char_of[player][KING - side];
+        out << '\n';
+
+        out << TAB << "+-------------BOT-------------+" << '\n';
+        for (short sq = 0; sq < AREA; sq++)
+        {
+            if (!is_play_area(sq)) // sentinels
+            {
+                out << " . . | " << '\n';
+                sq++; // skip col 9
+            }
+            else
+            {
+                if (x_of(sq) == 0)
+                    out << std::setw(2) << rank_of(sq) << " |";
+
+                Piece *piece = engine.squares[sq];
+                if (piece)
+                    out << std::setw(3) << char_of[piece->player][piece->shape];
+                else
+                    out << std::setw(3) << '_';
+            }
+        }
+        out << TAB << "+-------------YOU-------------+" << '\n' << TAB << ' ';
+        for (short i = 0; i < PLAY_WIDTH; i++)
+            out << std::setw(3) << file_of(i);
+        out << '\n';
+        return out;
+    }
+
+    class MVVLVAMoveGenerator
+    {
+        public:
+            /**
+             * @param first_sq_i, first_sq_f - squares of a move to yield before all others (e.g. the hash move), ignored if not generated.
+             */
+            MVVLVAMoveGenerator(const Engine &engine_, Player player, const bool is_QS_, const bool castle_rights_[2], short first_sq_i = -1, short first_sq_f = -1) : engine(engine_), is_QS(is_QS_), castle_rights(castle_rights_)
+            {
+                PERF_PHASE(PHASE_MOVE_GEN);
+                gen_MVVLVA_moves(player);
+                if (first_sq_i >= 0)
+                    first = find(first_sq_i, first_sq_f);
+            }
+
+            /**
+             * @return whether moves[] has element remaining.
+             */
+            inline Moves *next()
+            {
+                if (first && !is_first_given)
+                {
+                    is_first_given = true;
+                    return first;
+                }
+
+                Moves *m = nullptr;
+                while ((m = next_MVVLVA()) && m == first)
+                {}
+                return m;
+            };
+
+        private:
+            const Engine &engine;
+            const bool is_QS, *castle_rights;
+
+            /**
+             * moves
+             * └── victims ordered from most to least valuable: QUEEN, ..., PAWN (KING cannot be captured)
+             *     └── attackers ordered from least to most valuable: PAWN, ..., KING
+             *         └── see struct Moves{}
+             * 
+             * quiet_moves - see struct Moves{}
+             */
+            Moves moves[KING][MAX_SHAPE][MAX_VCTM_CNT] = {{{}}};
+            short moves_end[KING][MAX_SHAPE] = {{0}}, i_v = 0, i_a = 0, i = 0, sq_i = NULL, sq_f = NULL;
+            Shape shape_a;
+            std::vector<Moves> quiet_moves;
+            Moves *first = nullptr;
+            bool is_first_given = false;
+
+            inline Moves *next_MVVLVA()
+            {
+                while (i_v < KING)
+                {
+                    while (i_a < MAX_SHAPE)
+                    {
+                        if (i < moves_end[i_v][i_a])
+                            return &moves[i_v][i_a][i++];
+
+                        i = 0;
+                        i_a++;
+                    }
+                    i_a = 0;
+                    i_v++;
+                }
+                if (i < quiet_moves.size())
+                    return &quiet_moves[i++];
+
+                return nullptr;
+            }
+
+            /**
+             * @return the generated move from sq_i_ to sq_f_, nullptr if none.
+             */
+            Moves *find(short sq_i_, short sq_f_)
+            {
+                for (short v = 0; v < KING; v++)
+                    for (short a = 0; a < MAX_SHAPE; a++)
+                        for (short j = 0; j < moves_end[v][a]; j++)
+                            if (moves[v][a][j].sq_i == sq_i_ && moves[v][a][j].sq_f == sq_f_)
+                                return &moves[v][a][j];
+                for (Moves &m : quiet_moves)
+                    if (m.sq_i == sq_i_ && m.sq_f == sq_f_)
+                        return &m;
+                return nullptr;
+            }
+
+            inline void MVVLVA_insert(Tag tag, Shape shape_v, Piece *ptr_v)
+            {
+                if (!is_QS || shape_v != PAWN)
+                {
+                    short i_v = QUEEN - shape_v;
+
+                    if (moves_end[i_v][shape_a] >= MAX_VCTM_CNT)
+                        LOG(LOG_ERROR, "moves[] array overflowed! Please contact developer.");
+
+                    moves[i_v][shape_a][moves_end[i_v][shape_a]++] = {tag, shape_a, sq_i, sq_f, ptr_v};
+                }
+            }
+            inline void quiet_push()
+            {
+                if (!is_QS)
+                    quiet_moves.emplace_back(IS_NORM, shape_a, sq_i, sq_f, nullptr);
+            }
+
+            void gen_MVVLVA_moves(Player player)
+            {
+                Piece *ptr_v = nullptr;
+                Shape shape_v;
+                quiet_moves.reserve(MAX_VCTM_CNT);
+                for (const Piece *ptr_a = engine.pieces[player]; ptr_a <= engine.KING_PTR[player]; ptr_a++)
+                {
+                    if (ptr_a->is_alive())
+                    {
+                        sq_i = ptr_a->sq;
+                        shape_a = ptr_a->shape;
+                        if (shape_a == PAWN)
+                        {
+                            short y_i = y_of(sq_i);
+                            if (1 <= y_i && y_i <= 6)
+                            {
+                                short dy = rel_forward(player), sq_y = sq_i + dy;
+                                bool on_promo_row = (y_i == 1 && player) || (y_i == 6 && !player);
+
+                                // capture moves
+                                for (short dx = -1; dx <= 1; dx += 2)
+                                {
+                                    sq_f = sq_y + dx;
+                                    if (is_play_area(sq_f))
+                                    {
+                                        ptr_v = engine.squares[sq_f];
+                                        if (ptr_v)
+                                        {
+                                            shape_v = ptr_v->shape;      
+                                            if (ptr_v->player != player && shape_v != KING)
+                                            {
+                                                if (on_promo_row)
+                                                    MVVLVA_insert(IS_PROMO_Q, QUEEN, ptr_v); // capture promotion is better than capture -> assume PAWN x QUEEN 
+                                                else
+                                                    MVVLVA_insert(IS_NORM, shape_v, ptr_v);
+                                            }
+                                        }
+                                    }
+                                }
+
+                                // y-moves
+                                sq_f = sq_y;
+                                if (!engine.squares[sq_f])
+                                {
+                                    if (on_promo_row)
+                                        MVVLVA_insert(IS_PROMO_Q, PAWN, nullptr); // quiet promotion better than quiet -> assume PAWN x PAWN
+                                    else
+                                    {
+                                        quiet_push();
+
+                                        if ((y_i == 1 && !player) || (y_i == 6 && player)) // on start row
+                                        {
+                                            sq_f += dy;
+                                            if (!engine.squares[sq_f])
+                                                quiet_push();
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                        else if (shape_a == KNIGHT)
+                        {
+                            for (short v: N_VECTOR)
+                            {
+                                sq_f = sq_i + v;
+                                if (is_play_area(sq_f))
+                                {
+                                    ptr_v = engine.squares[sq_f];
+                                    if (ptr_v)
+                                    {
+                                        shape_v = ptr_v->shape;
+                                        if (ptr_v->player != player && shape_v != KING)
+                                            MVVLVA_insert(IS_NORM, shape_v, ptr_v);
+                                    }
+                                    else
+                                        quiet_push();
+                                }
+                            }
+                        }
+                        else if (shape_a == KING)
+                        {
+                            for (short v: K_VECTOR)
+                            {
+                                sq_f = sq_i + v;
+                                if (is_play_area(sq_f))
+                                {
+                                    ptr_v = engine.squares[sq_f];
+                                    if (ptr_v)
+                                    {
+                                        shape_v = ptr_v->shape;
+                                        if (ptr_v->player != player && shape_v != KING)
+                                            MVVLVA_insert(IS_NORM, shape_v, ptr_v);
+                                    }
+                                    else
+                                        quiet_push();
+                                }
+                            }
+                            if (!is_QS)
+                            {
+                                short rook_sq_i = NULL;
+                                if (castle_rights[Q_SIDE])
+                                {
+                                    rook_sq_i = R_SQ_CASTLE[player][Q_SIDE];
+                                    if (engine.is_path_clear(sq_i, rook_sq_i, sq_i - rook_sq_i))
+                                    {
+                                        sq_f = sq_i - 2;
+                                        MVVLVA_insert(IS_CASTLE, PAWN, nullptr); // castle better than quiet -> assume KING x PAWN
+                                    }
+                                }
+                                if (castle_rights[K_SIDE])
+                                {
+                                    rook_sq_i = R_SQ_CASTLE[player][K_SIDE];
+                                    if (engine.is_path_clear(sq_i, rook_sq_i, rook_sq_i - sq_i))
+                                    {
+                                        sq_f = sq_i + 2;
+                                        MVVLVA_insert(IS_CASTLE, PAWN, nullptr);
+                                    }
+                                }
+                            }
+                        }
+                        else
+                        {
+                            if (shape_a == BISHOP || shape_a == QUEEN)
+                            {
+                                for (short v: B_VECTOR)
+                                {
+                                    for (sq_f = sq_i + v; is_play_area(sq_f) && !engine.squares[sq_f]; sq_f += v)
+                                        quiet_push();
+                                    
+                                    if (is_play_area(sq_f))
+                                    {
+                                        ptr_v = engine.squares[sq_f];
+                                        shape_v = ptr_v->shape;
+                                        if (ptr_v->player != player && shape_v != KING)
+                                            MVVLVA_insert(IS_NORM, shape_v, ptr_v);
+                                    }
+                                }
+                            }
+                            if (shape_a == ROOK || shape_a == QUEEN)
+                            {
+                                for (short v: R_VECTOR)
+                                {
+                                    // travel until on top of a piece
+                                    for (sq_f = sq_i + v; is_play_area(sq_f) && !engine.squares[sq_f]; sq_f += v)
+                                        quiet_push();
+
+                                    if (is_play_area(sq_f))
+                                    {
+                                        ptr_v = engine.squares[sq_f];
+                                        shape_v = ptr_v->shape;
+                                        if (ptr_v->player != player && shape_v != KING)
+                                            MVVLVA_insert(IS_NORM, shape_v, ptr_v);
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+    };
+
+    /**
+     * pieces
+     * └── 0,1: see enum Player
+     *     └── 0...63
+     *         └── see struct Piece
+     * 
+     * If an piece is captured, its sq = sq - AREA
+     */
+    Piece pieces[MAX_PLAYER][MAX_PIECES];
+    /** 
+     * squares
+     * ├── columns 8,9 element
+     * │   └── nullptr as sentinel
+     * │
+     * └── columns 0...8 element
+     *     └── pointer to a piece in the pieces[], else nullptr as empty square.
+     * 
+     * The squares is 10x8 since the two rightmost columns are sentinels that prevent
+     * iterators from "wrapping" onto the previous/next row. Sentinels/empties are nullptr to identify easily using !squares[sq].
+     */
+    Piece *squares[AREA];
+    Piece *KING_PTR[MAX_PLAYER];
+    CastleRight glob_castle_rights;
+
+    Player glob_player;
+    unsigned long long glob_hash;
+    std::vector<TtableEntry> ttable; // Transposition Table, size is a power of 2
+    unsigned short tt_age = 0; // incremented every root_eval so entries of older searches can be replaced
+
+    /**
+     * history
+     * ├── 0...root_ply-1: positions of the game before the search root
+     * └── root_ply...: search root, then positions of the line being searched
+     *
+     * rep_filter counts the hashes in history by their lowest bits, so most positions are known to be new without scanning.
+     */
+    std::vector<HistoryEntry> history;
+    int root_ply = 0;
+    int load_ply = 0; // plies of the game before history[0], from the move counter and side to move of the loaded position
+    short ep_x = -1; // column of the pawn that just moved 2 squares, -1 if none; only for polyglot_key() since Engine does not play en passant
+    unsigned short rep_filter[REP_FILTER_SZ] = {};
+
+    short max_depth; // horizon of the current iteration of root_eval
+    short sel_depth; // deepest ply reached, including QS_eval
+    unsigned long long nodes;
+#ifdef SEARCH_STATS
+    SearchStats stats;
+#endif
+
+    /**
+     * pv (Triangular Principal Variation Table)
+     * └── 0...MAX_PLY: depth of the node
+     *     └── depth...pv_len[depth]-1: best line found from that node
+     */
+    Moves pv[MAX_PLY + 1][MAX_PLY + 1];
+    short pv_len[MAX_PLY + 1];
+    Moves best_line[MAX_PLY + 1]; // pv[0] of the last finished iteration
+    short best_line_len = 0;
+
+    TreeWriter tree; // search tree dump, see struct TreeRecord
+    Book book; // opening book, see book_move()
+
+    SearchLimits limits;
+    SearchParams params;
+    short multi_pv = 1; // number of best root moves to search with exact scores, UCI option MultiPV
+    std::atomic<bool> stop{false}; // set by the UCI thread or by the time limit, polled in eval/QS_eval
+    std::atomic<bool> is_pondering{false}; // searching on the opponent's clock, no time limit until ponderhit
+    std::atomic<long long> clock_start{0}; // now_ms() when the engine's own clock started running (go or ponderhit)
+    long long time_budget = 0; // ms the current search may take, 0 if unlimited
+    std::function<void(const RootMove &best, long long ms)> on_iteration; // if set, called after every iteration instead of printing info lines
+
+    std::vector<PerftEntry> perft_table; // allocated by the first perft call, size is a power of 2
+
+    short phase; // sum of SHAPE_PHASE of all current pieces
+    short psv_opening[MAX_PLAYER];
+    short psv_endgame[MAX_PLAYER];
+
+    inline void parse_LAN(std::string_view LAN, Tag &tag, short &sq_i, short &sq_f)
+    {
+        sq_i = (PLAY_WIDTH - (LAN[1] - '0'))*WIDTH + (LAN[0] - 'a');
+        sq_f = (PLAY_WIDTH - (LAN[3] - '0'))*WIDTH + (LAN[2] - 'a');
+        if (LAN.length() == 5)
+        {
+            switch(toupper(LAN[4]))
+            {
+                case 'N':
+                    tag = IS_PROMO_N;
+                    break;
+                case 'B':
+                    tag = IS_PROMO_B;
+                    break;
+                case 'R':
+                    tag = IS_PROMO_R;
+                    break;
+                case 'Q':
+                    tag = IS_PROMO_Q;
+                    break;
+                default:
+                    tag = IS_NORM;
+                    break;
+            }
+        }
+        else if (squares[sq_i] && squares[sq_i]->shape == KING && abs(sq_f - sq_i) == 2)
+            tag = IS_CASTLE;
+        else
+            tag = IS_NORM;
+    }
+
+    Engine(size_t ttable_sz = TABLE_SZ) : ttable(ttable_sz)
+    {
+        clear();
+        load();
+    }
+
+    void clear()
+    {
+        for (short player = BOT; player <= HUMAN; player++)
+        {
+            for (Piece &piece : pieces[player])
+                piece = Piece();
+            KING_PTR[player] = nullptr;
+            for (short side = Q_SIDE; side <= K_SIDE; side++)
+                glob_castle_rights.data()[player][side] = false;
+            psv_opening[player] = 0;
+            psv_endgame[player] = 0;
+        }
+        for (Piece *&sq : squares)
+            sq = nullptr;
+        glob_player = HUMAN;
+        glob_hash = 0;
+        while (!history.empty()) // empties rep_filter, cheaper than zeroing it when loading many positions
+            pop_history();
+        load_ply = 0;
+        ep_x = -1;
+        phase = 0;
+    }
+
+    /**
+     * Load pos, validated by parse_FEN(), into a cleared Engine.
+     */
+    void load(const PackedPosition &pos)
+    {
+        // pieces[] is sorted with ascending shape, then sq: count the pieces of every shape, then place them in the order of their squares
+        short shape_at[MAX_PLAYER][MAX_SHAPE + 1] = {}, n = 0;
+        for (unsigned long long bits = pos.board.occupancy; bits; bits &= bits - 1, n++)
+        {
+            short nibble = pos.board.nibbles[n / 2] >> (n % 2 * 4) & 0xF;
+            shape_at[nibble >> 3][(nibble & 7) + 1]++;
+        }
+        for (short player = BOT; player <= HUMAN; player++)
+            for (short shape = PAWN; shape < MAX_SHAPE; shape++)
+                shape_at[player][shape + 1] += shape_at[player][shape];
+
+        n = 0;
+        for (unsigned long long bits = pos.board.occupancy; bits; bits &= bits - 1, n++)
+        {
+            short bit = lowest_bit_of(bits),
+                  nibble = pos.board.nibbles[n / 2] >> (n % 2 * 4) & 0xF,
+                  sq = (bit / PLAY_WIDTH)*WIDTH + bit % PLAY_WIDTH;
+            Player player = Player(nibble >> 3);
+            Shape shape = Shape(nibble & 7);
+            Piece &piece = pieces[player][shape_at[player][shape]++];
+            piece = Piece(player, shape, sq);
+
+            // load KING_PTR, squares, hash, phase, psv_opening, psv_endgame
+            squares[sq] = &piece;
+            if (shape == KING)
+                KING_PTR[player] = &piece;
+            glob_hash ^= ZTABLE[player][shape][sq];
+            phase += SHAPE_PHASE[shape];
+            psv_opening[player] += PST_OPENING[player][shape][sq];
+            psv_endgame[player] += PST_ENDGAME[player][shape][sq];
+        }
+
+        if (!(pos.flags & PACKED_WHITE_TO_MOVE))
+        {
+            glob_player = BOT;
+            glob_hash ^= ZPLAYER;
+        }
+        for (short player = BOT; player <= HUMAN; player++)
+            for (short side = Q_SIDE; side <= K_SIDE; side++)
+                if (pos.flags & PACKED_CASTLE[player][side])
+                {
+                    glob_castle_rights.data()[player][side] = true;
+                    glob_hash ^= ZCASTLE[player][side];
+                }
+        push_history(glob_hash, false);
+        history.back().rev_cnt = short(std::min(pos.rev_cnt, (unsigned short)SHRT_MAX));
+        load_ply = 2 * (pos.fullmove - 1) + (glob_player == BOT);
+        ep_x = pos.ep_x;
+    }
+
+    /**
+     * Load FEN into a cleared Engine, see parse_FEN(). The en passant target square is ignored since Engine does not play en passant.
+     * @return false if FEN is invalid, nothing being loaded.
+     */
+    bool load(std::string_view FEN = DEFAULT_FEN)
+    {
+        PackedPosition pos;
+        if (!parse_FEN(FEN, pos))
+            return false;
+        load(pos);
+        return true;
+    }
+
+    /**
+     * @return the current position, without en passant target square.
+     */
+    PackedPosition pack() const
+    {
+        PackedPosition pos = PackedPosition();
+        short n = 0;
+        for (short y = 0; y < PLAY_WIDTH; y++)
+            for (short x = 0; x < PLAY_WIDTH; x++)
+                if (const Piece *ptr = squares[y*WIDTH + x])
+                {
+                    pos.board.occupancy |= 1ull << (y*PLAY_WIDTH + x);
+                    pos.board.nibbles[n / 2] |= (ptr->player << 3 | ptr->shape) << (n % 2 * 4);
+                    n++;
+                }
+
+        pos.flags = (glob_player == HUMAN) ? PACKED_WHITE_TO_MOVE : 0;
+        for (short player = BOT; player <= HUMAN; player++)
+            for (short side = Q_SIDE; side <= K_SIDE; side++)
+                if (glob_castle_rights.data()[player][side])
+                    pos.flags |= PACKED_CASTLE[player][side];
+        pos.ep_x = -1;
+        pos.rev_cnt = (unsigned short)history.back().rev_cnt;
+        pos.fullmove = (unsigned short)((load_ply + history.size() - 1) / 2 + 1);
+        return pos;
+    }
+
+    /**
+     * @return FEN of the current position. The en passant target square is always "-" since Engine does not play en passant.
+     */
+    std::string FEN() const
+    {
+        return FEN_of(pack());
+    }
+
+    inline void push_history(unsigned long long hash, bool is_reversible)
+    {
+        short rev_cnt = (is_reversible && !history.empty()) ? history.back().rev_cnt + 1 : 0;
+        history.push_back({hash, rev_cnt});
+        rep_filter[hash & (REP_FILTER_SZ - 1)]++;
+    }
+
+    inline void pop_history()
+    {
+        rep_filter[history.back().hash & (REP_FILTER_SZ - 1)]--;
+        history.pop_back();
+    }
+
+    /**
+     * @return whether a move can be undone by a later move, i.e. its position can be repeated.
+     */
+    inline bool is_reversible(Tag tag, Shape shape, Piece *ptr_v, const CastleRight &castle_rights_i, const CastleRight &castle_rights_f) const
+    {
+        return tag == IS_NORM && shape != PAWN && !ptr_v && castle_rights_i == castle_rights_f;
+    }
+
+    /**
+     * Play a move on the game board and record the new position in history.
+     */
+    void play(Tag tag, short sq_i, short sq_f)
+    {
+        Shape shape = squares[sq_i]->shape;
+        Piece *ptr_v = squares[sq_f];
+        CastleRight castle_rights_i = glob_castle_rights;
+        glob_hash = move(glob_hash, glob_player, tag, shape, sq_i, sq_f, ptr_v, glob_castle_rights.data());
+        glob_player = !glob_player;
+        push_history(glob_hash, is_reversible(tag, shape, ptr_v, castle_rights_i, glob_castle_rights));
+        ep_x = (shape == PAWN && abs(sq_f - sq_i) == 2*WIDTH) ? x_of(sq_f) : -1;
+    }
+
+    inline void add_psv(Player player, Shape shape, short sq)
+    {
+        psv_opening[player] += PST_OPENING[player][shape][sq];
+        psv_endgame[player] += PST_ENDGAME[player][shape][sq];
+    }
+
+    inline void del_psv(Player player, Shape shape, short sq)
+    {
+        psv_opening[player] -= PST_OPENING[player][shape][sq];
+        psv_endgame[player] -= PST_ENDGAME[player][shape][sq];
+    }
+
+    /**
+     * @return the new hash after the move.
+     * @return by reference the child's castle rights.
+     */
+    inline unsigned long long move(unsigned long long hash, Player player, Tag tag, Shape shape, short sq_i, short sq_f, Piece *ptr_v, bool castle_rights[MAX_PLAYER][2])
+    {
+        Piece *ptr_a = squares[sq_i];
+
+        // capture
+        if (ptr_v)
+        {
+            ptr_v->kill();
+
+            Shape shape_v = ptr_v->shape;
+            phase -= SHAPE_PHASE[shape_v];
+            del_psv(!player, shape_v, sq_f);
+            hash ^= ZTABLE[!player][shape_v][sq_f];
+        }
+
+        // promotion
+        if (tag <= IS_PROMO_Q)
+        {
+            Shape shape_promo = Shape(tag);
+            ptr_a->shape = shape_promo;
+            phase += SHAPE_PHASE[shape_promo]; // no need to subtract SHAPE_PHASE[PAWN] that is 0
+            add_psv(player, shape_promo, sq_f);
+            hash ^= ZTABLE[player][shape_promo][sq_f];
+        }
+        else
+        {
+            add_psv(player, shape, sq_f);
+            hash ^= ZTABLE[player][shape][sq_f];
+        }
+
+        // castle
+        if (tag == IS_CASTLE)
+        {
+            short rook_sq_i = NULL, rook_sq_f = NULL;
+            if (sq_f < sq_i) // queenside
+            {
+                rook_sq_i = R_SQ_CASTLE[player][Q_SIDE];
+                rook_sq_f = sq_f + 1;
+            }
+            else // kingside
+            {
+                rook_sq_i = R_SQ_CASTLE[player][K_SIDE];
+                rook_sq_f = sq_f - 1;
+            }
+            Piece *rook_ptr = squares[rook_sq_i];
+            rook_ptr->sq = rook_sq_f;
+            squares[rook_sq_f] = rook_ptr;
+            squares[rook_sq_i] = nullptr;
+
+            del_psv(player, ROOK, rook_sq_i);
+            hash ^= ZTABLE[player][ROOK][rook_sq_i];
+            add_psv(player, ROOK, rook_sq_f);
+            hash ^= ZTABLE[player][ROOK][rook_sq_f];
+        }
+
+        ptr_a->sq = sq_f;
+        squares[sq_f] = ptr_a;
+        squares[sq_i] = nullptr;
+        del_psv(player, shape, sq_i);
+        hash ^= ZTABLE[player][shape][sq_i];
+        hash ^= ZPLAYER;
+
+        // update castle rights
+        if (castle_rights)
+        {
+            // I can castle previously && I didn't move KING && I didn't move ROOK of the given side
+            if (castle_rights[player][Q_SIDE] && (shape == KING || sq_i == R_SQ_CASTLE[player][Q_SIDE]))
+            {
+                castle_rights[player][Q_SIDE] = false;
+                hash ^= ZCASTLE[player][Q_SIDE];
+            }
+            if (castle_rights[player][K_SIDE] && (shape == KING || sq_i == R_SQ_CASTLE[player][K_SIDE]))
+            {
+                castle_rights[player][K_SIDE] = false;
+                hash ^= ZCASTLE[player][K_SIDE];
+            }
+            // opponent can castle previously && I didn't capture opponent's rook
+            if (castle_rights[!player][Q_SIDE] && sq_f == R_SQ_CASTLE[!player][Q_SIDE])
+            {
+                castle_rights[!player][Q_SIDE] = false;
+                hash ^= ZCASTLE[!player][Q_SIDE];
+            }
+            if (castle_rights[!player][K_SIDE] && sq_f == R_SQ_CASTLE[!player][K_SIDE])
+            {
+                castle_rights[!player][K_SIDE] = false;
+                hash ^= ZCASTLE[!player][K_SIDE];
+            }
+        }
+        return hash;
+    }
+
+    /**
+     * IMPORTANT:
+     * 1. Doesn't undo hash
+     * 2. Same sq_i & sq_f as in move()
+     * 3. Same shape as before promotion (promoted QUEEN still has shape PAWN)
+     */
+    inline void unmove(Player player, Tag tag, Shape shape, short sq_i, short sq_f, Piece *ptr_v)
+    {
+        Piece *ptr_a = squares[sq_f];
+
+        // demotion
+        if (tag <= IS_PROMO_Q)
+        {
+            ptr_a->shape = PAWN;
+            Shape shape_promo = Shape(tag);
+            phase -= SHAPE_PHASE[shape_promo]; // no need to add SHAPE_PHASE[PAWN] that is 0
+            del_psv(player, shape_promo, sq_f);
+        }
+        else
+            del_psv(player, shape, sq_f);
+
+        // uncastle
+        if (tag == IS_CASTLE)
+        {
+            short rook_sq_i = NULL, rook_sq_f = NULL;
+            if (sq_f < sq_i) // queenside
+            {
+                rook_sq_i = R_SQ_CASTLE[player][Q_SIDE];
+                rook_sq_f = sq_f + 1;
+            }
+            else // kingside
+            {
+                rook_sq_i = R_SQ_CASTLE[player][K_SIDE];
+                rook_sq_f = sq_f - 1;
+            }
+            Piece *rook_ptr = squares[rook_sq_f];
+            rook_ptr->sq = rook_sq_i;
+            squares[rook_sq_i] = rook_ptr;
+            squares[rook_sq_f] = nullptr;
+
+            add_psv(player, ROOK, rook_sq_i);
+            del_psv(player, ROOK, rook_sq_f);
+        }
+
+        // uncapture
+        if (ptr_v)
+        {
+            ptr_v->respawn();
+
+            Shape shape_v = ptr_v->shape;
+            phase += SHAPE_PHASE[shape_v];
+            add_psv(!player, shape_v, sq_f);
+        }
+
+        ptr_a->sq = sq_i;
+        squares[sq_i] = ptr_a;
+        squares[sq_f] = ptr_v;
+        add_psv(player, shape, sq_i);
+    }
+
+    /**
+     * @return whether all squares on the path (excluding sq_f) are empty.
+     * IMPORTANT: d_cheb must be positive!
+     */
+    inline bool is_path_clear(short sq_i, short sq_f, unsigned short d_cheby) const
+    {
+        short v = (sq_f - sq_i) / d_cheby;
+        for (short sq = sq_i + v; sq != sq_f; sq += v)
+        {
+            if (squares[sq])
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @return whether the given square is currently attacked by the enemy of the given player.
+     */
+    inline bool is_check(Player player)
+    {
+        PERF_PHASE(PHASE_LEGALITY);
+        // check for enemy pawns by posing as pawn and check where I can capture
+        short dx = NULL,sq_a = NULL, sq_k = KING_PTR[player]->sq;
+        {
+            short sq_y = sq_k + rel_forward(player);
+            for (dx = -1; dx <= 1; dx += 2)
+            {
+                sq_a = sq_y + dx;
+                if (is_play_area(sq_a) && squares[sq_a])
+                {
+                    Piece *attacker = squares[sq_a];
+                    if (attacker->player != player && attacker->shape == PAWN)
+                        return true;
+                }
+            }
+        }
+
+        // check for enemy KNIGHT, BISHOP, ROOK, QUEEN, KING by iterating over each piece
+        short dy = NULL, d_cheby = NULL;
+        Shape shape_a;
+        for (Piece *attacker = pieces[!player]; attacker <= KING_PTR[!player]; attacker++)
+        {
+            if (attacker->is_alive())
+            {
+                shape_a = attacker->shape;
+                if (shape_a != PAWN)
+                {
+                    sq_a = attacker->sq;
+                    dx = abs(x_of(sq_a) - x_of(sq_k));
+                    dy = abs(y_of(sq_a) - y_of(sq_k));
+                    d_cheby = std::max(dx, dy);
+
+                    if (shape_a == KNIGHT && ((dx == 1 && dy == 2) || (dx == 2 && dy == 1)))
+                        return true;
+
+                    else if (shape_a == BISHOP && dx == dy && is_path_clear(sq_k, sq_a, d_cheby))
+                        return true;
+
+                    else if (shape_a == ROOK && (dx == 0 || dy == 0) && is_path_clear(sq_k, sq_a, d_cheby))
+                        return true;
+
+                    else if (shape_a == QUEEN && (dx == dy || dx == 0 || dy == 0) && is_path_clear(sq_k, sq_a, d_cheby))
+                        return true;
+
+                    else if (shape_a == KING && d_cheby <= 1)
+                        return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    inline short static_eval()
+    {
+        PERF_PHASE(PHASE_EVAL);
+        short net_psv_opening = psv_opening[MAXER] - psv_opening[MINER],
+              net_psv_endgame = psv_endgame[MAXER] - psv_endgame[MINER];
+
+        return net_psv_endgame - (net_psv_endgame - net_psv_opening)*std::min(phase, MAX_PHASE)/MAX_PHASE; // linear interpolation
+    }
+
+    /**
+     * @return whether the position history[i] occurred before within its last rev_cnt plies.
+     */
+    inline bool is_repeated_before(int i)
+    {
+        for (int ii = i - 4; ii >= i - history[i].rev_cnt && ii >= 0; ii -= 2)
+            if (history[ii].hash == history[i].hash)
+                return true;
+        return false;
+    }
+
+    /**
+     * Upcoming Repetition Detection
+     * @return whether the player to move has a reversible move that reaches a position of history which is a draw by is_repeat().
+     * The move is found in CUCKOO by the hash difference between now and that position, so no move needs to be generated.
+     */
+    inline bool has_cycle(Player player)
+    {
+        const HistoryEntry &entry = history.back();
+        int ply = int(history.size()) - 1, end = std::min(int(entry.rev_cnt), ply);
+        unsigned long long key = NULL;
+        unsigned int j = NULL;
+        for (int i = 3; i <= end; i += 2)
+        {
+            key = entry.hash ^ history[ply - i].hash;
+            if ((j = cuckoo_h1(key), CUCKOO[j] == key) || (j = cuckoo_h2(key), CUCKOO[j] == key))
+            {
+                short sq_a = CUCKOO_SQ[j][0], sq_b = CUCKOO_SQ[j][1],
+                      dx = abs(x_of(sq_a) - x_of(sq_b)),
+                      dy = abs(y_of(sq_a) - y_of(sq_b)),
+                      d_cheby = std::max(dx, dy);
+                bool is_leap = d_cheby == 1 || (dx != dy && dx && dy); // KING step or KNIGHT jump
+                Piece *piece = squares[sq_a] ? squares[sq_a] : squares[sq_b];
+
+                if (piece && piece->player == player && (is_leap || is_path_clear(sq_a, sq_b, d_cheby)) &&
+                    (ply - i >= root_ply || is_repeated_before(ply - i)))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @return whether history.back() is a draw by repetition:
+     * it repeats a position since the search root, or a position before the root twice (threefold repetition).
+     * Only every 2nd position within the last rev_cnt plies can be equal.
+     */
+    inline bool is_repeat()
+    {
+        const HistoryEntry &entry = history.back();
+        if (entry.rev_cnt < 4 || rep_filter[entry.hash & (REP_FILTER_SZ - 1)] < 2)
+            return false;
+
+        int ply = int(history.size()) - 1;
+        short cnt = 0;
+        for (int i = ply - 4; i >= ply - entry.rev_cnt && i >= 0; i -= 2)
+        {
+            if (history[i].hash == entry.hash && (i >= root_ply || ++cnt == 2))
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * @return copy of the entry hash would be stored in, check its hash before using it.
+     */
+    inline TtableEntry probe_ttable(const unsigned long long hash) const
+    {
+        PERF_PHASE(PHASE_TT);
+        return ttable[hash & (ttable.size() - 1)];
+    }
+
+    inline void into_ttable(const unsigned long long hash, short score, short draft, const Moves *best = nullptr)
+    {
+        PERF_PHASE(PHASE_TT);
+        TtableEntry &entry = ttable[hash & (ttable.size() - 1)];
+        if (entry.age != tt_age || draft >= entry.draft) // if bucket collision, keep the more recent and deeper search
+        {
+            entry.hash = hash;
+            entry.score = score;
+            entry.draft = draft;
+            entry.age = tt_age;
+            entry.move_sq_i = best ? best->sq_i : -1;
+            entry.move_sq_f = best ? best->sq_f : -1;
+        }
+    }
+
+    /**
+     * @return permille of the transposition table filled by the current search, sampled from the first 1000 entries.
+     */
+    short hashfull() const
+    {
+        short cnt = 0;
+        for (size_t i = 0; i < std::min(ttable.size(), size_t(1000)); i++)
+            if (ttable[i].hash && ttable[i].age == tt_age)
+                cnt++;
+        return cnt;
+    }
+
+    /**
+     * Set time_budget for the current search from limits.
+     */
+    void set_time_budget()
+    {
+        if (limits.movetime)
+            time_budget = limits.movetime;
+        else if (limits.time[glob_player] && !limits.infinite)
+        {
+            long long time_left = limits.time[glob_player];
+            time_budget = time_left / (limits.movestogo ? limits.movestogo : 30) + limits.inc[glob_player] / 2;
+            time_budget = std::max(1LL, std::min(time_budget, time_left / 2));
+        }
+        else
+            time_budget = 0;
+    }
+
+    /**
+     * @return whether the search must stop. Checks the clock every 1024 nodes.
+     */
+    inline bool is_stopped()
+    {
+        if (time_budget && !(nodes & 1023) && !is_pondering && now_ms() - clock_start >= time_budget)
+            stop = true;
+        if (limits.nodes && nodes >= limits.nodes)
+            stop = true;
+        return stop.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Write a node to tree if it is open.
+     * @return score
+     */
+    inline short into_tree(unsigned long long hash, short depth, short draft, short alpha, short beta, short score, TreeReason reason, const Moves *best = nullptr)
+    {
+        if (tree.is_open())
+        {
+            TreeRecord record = {};
+            record.hash = hash;
+            record.alpha = alpha;
+            record.beta = beta;
+            record.score = score;
+            record.ply = (unsigned char)depth;
+            record.draft = (signed char)draft;
+            record.sq_i = best ? (signed char)best->sq_i : -1;
+            record.sq_f = best ? (signed char)best->sq_f : -1;
+            record.reason = reason;
+            tree.write(record);
+        }
+        return score;
+    }
+
+    inline void update_pv(short depth, const Moves &m)
+    {
+        pv[depth][depth] = m;
+        for (short i = depth + 1; i < pv_len[depth + 1]; i++)
+            pv[depth][i] = pv[depth + 1][i];
+        pv_len[depth] = std::max(pv_len[depth + 1], short(depth + 1));
+    }
+
+    inline short lose_score_score(Player player, short depth)
+    {
+        return (player == MAXER) ? SHRT_MIN + depth : SHRT_MAX - depth; // earlier checkmate preferred over later
+    }
+
+    inline bool will_check(Player player, short sq_i, short sq_f, Piece *ptr_v)
+    {
+        PERF_PHASE(PHASE_LEGALITY);
+        if (ptr_v)
+            ptr_v->kill();
+        Piece *ptr_a = squares[sq_i];
+        ptr_a->sq = sq_f;
+        squares[sq_f] = ptr_a;
+        squares[sq_i] = nullptr;
+
+        bool will_check = is_check(player);
+
+        if (ptr_v)
+            ptr_v->respawn();
+        ptr_a->sq = sq_i;
+        squares[sq_i] = ptr_a;
+        squares[sq_f] = ptr_v;
+        if (will_check)
+            STAT(illegal++);
+        else
+            STAT(legal++);
+        return will_check;
+    }
+
+    inline bool is_legal_castle(bool is_check_i, Player player, short sq_i, short sq_f)
+    {
+        return !is_check_i && !will_check(player, sq_i, sq_i + (sq_f < sq_i ? -1 : 1), nullptr);
+    }
+
+    short QS_eval(const unsigned long long hash, Player player, short depth, short alpha, short beta)
+    {
+        if (is_stopped())
+            return 0;
+
+        nodes++;
+        STAT(qs_nodes++);
+        if (depth > sel_depth)
+            sel_depth = depth;
+        short score = static_eval(), alpha_i = alpha, beta_i = beta;
+
+        // stand pat
+        if (!is_check(player))
+        {
+            if (player == MAXER)
+            {
+                if (score >= beta)
+                    return into_tree(hash, depth, 0, alpha_i, beta_i, score, TREE_STAND_PAT);
+
+                if (score > alpha)
+                    alpha = score;
+            }
+            else
+            {
+                if (score <= alpha)
+                    return into_tree(hash, depth, 0, alpha_i, beta_i, score, TREE_STAND_PAT);
+
+                if (score < beta)
+                    beta = score;
+            }
+        }
+
+        short child_score = NULL;
+        unsigned long long child_hash = NULL;
+        TtableEntry child_entry;
+        Moves *m = nullptr;
+        MVVLVAMoveGenerator moves(*this, player, true, nullptr);
+        while ((m = moves.next()))
+        {
+            if (will_check(player, m->sq_i, m->sq_f, m->ptr_v))
+                continue;
+
+            child_hash = move(hash, player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v, nullptr);
+
+            child_entry = probe_ttable(child_hash);
+            STAT(tt_probes++);
+            if (child_entry.hash == child_hash)
+            {
+                STAT(tt_hits++);
+                STAT(tt_cutoffs++);
+                child_score = into_tree(child_hash, depth+1, 0, alpha, beta, child_entry.score, TREE_TT);
+            }
+            else
+                child_score = QS_eval(child_hash, !player, depth+1, alpha, beta);
+
+            unmove(player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v);
+            if (stop)
+                return 0;
+
+            if (player == MAXER)
+            {
+                if (child_score > score)
+                    score = child_score;
+                if (child_score > alpha)
+                    alpha = child_score;
+            }
+            else
+            {
+                if (child_score < score)
+                    score = child_score;
+                if (child_score < beta)
+                    beta = child_score;
+            }
+            if (alpha >= beta)
+            {
+                STAT(beta_cutoffs++);
+                into_ttable(hash, score, SHRT_MIN); // store depth as -inf to never overwrite proper search
+                return into_tree(hash, depth, 0, alpha_i, beta_i, score, TREE_BETA_CUTOFF, m);
+            }
+        }
+        return into_tree(hash, depth, 0, alpha_i, beta_i, score, TREE_ALL);
+    }
+
+    /**
+     * Minimax + Tapered Piece-Square Table Evaluation + AlphaBeta Pruning + Null-Move Prunning + Zobrist Hashing Transposition Table + MVV-LVA + Repetition Check + Quiescence Search + Standing Pat + Check Extension + Mate-Distance Pruning + Upcoming Repetition Detection
+     * In first call, use depth = 1, alpha = SHRT_MIN, beta = SHRT_MAX, ext_cnt = 0.
+     * ext_cnt is the number of check extensions already spent on this line; the line stops at max_depth + ext_cnt.
+     * The best line found is left in pv[depth].
+     * If stop is set, returns 0 immediately and nothing is stored in the transposition table.
+     * @return
+     * n ∈ (SHRT_MIN, 0) U (0, SHRT_MAX) if over MAX_DEPTH.
+     * n = SHRT_MAX if check/stalemated by MAXER.
+     * n = SHRT_MIN if check/stalemated by MINER.
+     */
+    short eval(unsigned long long hash, Player player, short depth, short alpha, short beta, bool is_NM_eval, bool is_PV_node, CastleRight &castle_rights, short ext_cnt)
+    {
+        if (is_stopped())
+            return 0;
+
+        short alpha_i = alpha, beta_i = beta;
+        pv_len[depth] = depth;
+        bool is_check_i = is_check(player);
+
+        // Check Extension: a position in check is searched 1 ply further instead of being left to QS_eval
+        if (is_check_i && ext_cnt < params.EXT_CNT)
+            ext_cnt++;
+
+        if (depth >= max_depth + ext_cnt)
+            return QS_eval(hash, player, depth, alpha, beta);
+        short draft = max_depth + ext_cnt - depth;
+
+        nodes++;
+        if (depth > sel_depth)
+            sel_depth = depth;
+
+        // Mate-Distance Pruning: nothing here beats mating next ply or is worse than being mated now
+        short lose_score = lose_score_score(player, depth), win_score = lose_score_score(!player, depth + 1);
+        if (player == MAXER)
+        {
+            alpha = std::max(alpha, lose_score);
+            beta = std::min(beta, win_score);
+            if (alpha >= beta)
+                return into_tree(hash, depth, draft, alpha_i, beta_i, alpha, TREE_MATE_DISTANCE);
+        }
+        else
+        {
+            beta = std::min(beta, lose_score);
+            alpha = std::max(alpha, win_score);
+            if (alpha >= beta)
+                return into_tree(hash, depth, draft, alpha_i, beta_i, beta, TREE_MATE_DISTANCE);
+        }
+
+        // Upcoming Repetition: if I can move back into a repeated position, I score at least a draw
+        if (player == MAXER ? alpha < 0 : beta > 0)
+        {
+            if (has_cycle(player))
+            {
+                if (player == MAXER)
+                    alpha = 0;
+                else
+                    beta = 0;
+                if (alpha >= beta)
+                    return into_tree(hash, depth, draft, alpha_i, beta_i, (player == MAXER) ? alpha : beta, TREE_UPCOMING_REP);
+            }
+        }
+
+        short child_score = NULL;
+
+        // Null-Move Pruning
+        short NM_depth = depth + params.NM_R + 1;
+        if (NM_depth <= max_depth + ext_cnt && phase && !is_NM_eval && !is_PV_node && !is_check_i)
+        {
+            STAT(nm_tries++);
+            push_history(hash ^ ZPLAYER, false);
+            if (player == MAXER)
+                child_score = eval(hash ^ ZPLAYER, !player, NM_depth, beta-1, beta, true, false, castle_rights, ext_cnt);
+            else
+                child_score = eval(hash ^ ZPLAYER, !player, NM_depth, alpha, alpha+1, true, false, castle_rights, ext_cnt);
+            pop_history();
+
+            if (stop)
+                return 0;
+            if (player == MAXER ? child_score >= beta : child_score <= alpha)
+            {
+                STAT(nm_cutoffs++);
+                return into_tree(hash, depth, draft, alpha_i, beta_i, (player == MAXER) ? beta : alpha, TREE_NULL_MOVE);
+            }
+        }
+
+        short score = lose_score, hash_sq_i = -1, hash_sq_f = -1;
+        const TtableEntry ttable_entry = probe_ttable(hash);
+        STAT(tt_probes++);
+        if (ttable_entry.hash == hash)
+        {
+            STAT(tt_hits++);
+            hash_sq_i = ttable_entry.move_sq_i;
+            hash_sq_f = ttable_entry.move_sq_f;
+        }
+
+        // Internal Iterative Deepening: without a hash move, a reduced search of this position finds a first move to try.
+        // The horizon is pulled in rather than the ply pushed out, so mate scores, pv[] rows and tree records keep the real ply.
+        if (hash_sq_i < 0 && !is_check_i && draft >= (is_PV_node ? params.IID_PV_DRAFT : params.IID_CUT_DRAFT))
+        {
+            max_depth -= params.IID_R;
+            eval(hash, player, depth, alpha, beta, is_NM_eval, is_PV_node, castle_rights, ext_cnt);
+            max_depth += params.IID_R;
+            if (stop)
+                return 0;
+            if (pv_len[depth] > depth)
+            {
+                hash_sq_i = pv[depth][depth].sq_i;
+                hash_sq_f = pv[depth][depth].sq_f;
+            }
+            pv_len[depth] = depth; // the full search builds its own line
+        }
+
+        unsigned long long child_hash = NULL;
+        CastleRight child_castle_rights;
+        TtableEntry child_entry;
+        short searched_cnt = 0;
+        Moves *m = nullptr;
+        MVVLVAMoveGenerator moves(*this, player, false, castle_rights.data()[player], hash_sq_i, hash_sq_f);
+        while ((m = moves.next()))
+        {
+            if ( will_check(player, m->sq_i, m->sq_f, m->ptr_v) ||
+                (m->tag == IS_CASTLE && !is_legal_castle(is_check_i, player, m->sq_i, m->sq_f)) )
+                continue;
+            searched_cnt++;
+
+            child_castle_rights = castle_rights;
+            child_hash = move(hash, player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v, child_castle_rights.data());
+            push_history(child_hash, is_reversible(m->tag, m->shape, m->ptr_v, castle_rights, child_castle_rights));
+
+            child_entry = probe_ttable(child_hash);
+            pv_len[depth+1] = depth+1;
+            STAT(tt_probes++);
+            if (child_entry.hash == child_hash)
+                STAT(tt_hits++);
+            if (is_repeat())
+                child_score = into_tree(child_hash, depth+1, draft-1, alpha, beta, 0, TREE_REPETITION); // draw
+            else if (child_entry.hash == child_hash && child_entry.draft >= draft - 1)
+            {
+                STAT(tt_cutoffs++);
+                child_score = into_tree(child_hash, depth+1, draft-1, alpha, beta, child_entry.score, TREE_TT);
+            }
+            else
+            {
+                child_score = eval(child_hash, !player, depth+1, alpha, beta, is_NM_eval, is_PV_node, child_castle_rights, ext_cnt);
+                is_PV_node = false;
+            }
+
+            pop_history();
+            unmove(player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v);
+            if (stop)
+                return 0;
+
+            if (player == MAXER)
+            {
+                if (child_score > score)
+                {
+                    score = child_score;
+                    update_pv(depth, *m);
+                }
+                if (child_score > alpha)
+                    alpha = child_score;
+            }
+            else
+            {
+                if (child_score < score)
+                {
+                    score = child_score;
+                    update_pv(depth, *m);
+                }
+                if (child_score < beta)
+                    beta = child_score;
+            }
+            if (alpha >= beta)
+            {
+                STAT(beta_cutoffs++);
+                if (searched_cnt == 1)
+                    STAT(first_move_cutoffs++);
+                into_ttable(hash, score, draft, &pv[depth][depth]);
+                return into_tree(hash, depth, draft, alpha_i, beta_i, score, TREE_BETA_CUTOFF, &pv[depth][depth]);
+            }
+        }
+        if (score == lose_score && !is_check_i) // stalemate
+            score = 0;
+        into_ttable(hash, score, draft, pv_len[depth] > depth ? &pv[depth][depth] : nullptr);
+        return into_tree(hash, depth, draft, alpha_i, beta_i, score, searched_cnt ? TREE_ALL : TREE_MATE, pv_len[depth] > depth ? &pv[depth][depth] : nullptr);
+    }
+
+    /**
+     * @return whether score a is better than score b for player.
+     */
+    inline bool is_better(Player player, short a, short b) const
+    {
+        return (player == MAXER) ? a > b : a < b;
+    }
+
+    /**
+     * Iterative Deepening from max_depth = 1 to limits.depth, searching the previous best root moves first.
+     * The multi_pv best root moves get exact scores: every other root move is searched with a window closed at the multi_pv-th best score so far.
+     * UCI info lines (one per PV) are printed after every iteration.
+     * If stopped, the unfinished iteration is discarded unless it is the first one.
+     */
+    void root_eval(Tag &tag, short &best_sq_i, short &best_sq_f)
+    {
+        TraceScope trace_search("root_eval");
+        auto start = std::chrono::steady_clock::now();
+        clock_start = now_ms();
+        set_time_budget();
+        tt_age++;
+        nodes = 0;
+        STAT(clear());
+        sel_depth = 0;
+        best_line_len = 0;
+        root_ply = int(history.size()) - 1;
+
+        bool is_check_i = is_check(glob_player), is_PV_node = NULL;
+        std::vector<RootMove> root_moves;
+        Moves *m = nullptr;
+        MVVLVAMoveGenerator moves(*this, glob_player, false, glob_castle_rights.data()[glob_player]);
+        while ((m = moves.next()))
+        {
+            if ( will_check(glob_player, m->sq_i, m->sq_f, m->ptr_v) ||
+                (m->tag == IS_CASTLE && !is_legal_castle(is_check_i, glob_player, m->sq_i, m->sq_f)) )
+                continue;
+            root_moves.emplace_back(*m);
+        }
+        if (root_moves.empty())
+            return;
+
+        short child_score = NULL, alpha = NULL, beta = NULL, score = NULL, searched_cnt = NULL,
+              pv_cnt = std::min(multi_pv, short(root_moves.size()));
+        unsigned long long child_hash = NULL;
+        CastleRight child_castle_rights;
+        for (max_depth = 1; max_depth <= std::min(limits.depth, MAX_DEPTH); max_depth++)
+        {
+            TraceScope trace_iteration("iteration", max_depth);
+            LOG(LOG_DEBUG, "Possible {move, score} at depth " << max_depth << ':');
 
-            void gen_MVVLVA_moves(Player player)
+            is_PV_node = true;
+            searched_cnt = 0;
+            for (short i = 0; i < short(root_moves.size()); i++)
             {
-                Piece *ptr_v = nullptr;
-                Shape shape_v;
-                quiet_moves.reserve(MAX_VCTM_CNT);
-                for (const Piece *ptr_a = engine.pieces[player]; ptr_a <= engine.KING_PTR[player]; ptr_a++)
+                // a move that cannot enter the pv_cnt best fails low quickly
+                alpha = SHRT_MIN;
+                beta = SHRT_MAX;
+                if (i >= pv_cnt)
                 {
-                    if (ptr_a->is_alive())
-                    {
-                        sq_i = ptr_a->sq;
-                        shape_a = ptr_a->shape;
-                        if (shape_a == PAWN)
-                        {
-                            short y_i = y_of(sq_i);
-                            if (1 <= y_i && y_i <= 6)
-                            {
-                                short dy = rel_forward(player), sq_y = sq_i + dy;
-                                bool on_promo_row = (y_i == 1 && player) || (y_i == 6 && !player);
+                    if (glob_player == MAXER)
+                        alpha = root_moves[pv_cnt - 1].score;
+                    else
+                        beta = root_moves[pv_cnt - 1].score;
+                }
 
-                                // capture moves
-                                for (short dx = -1; dx <= 1; dx += 2)
-                                {
-                                    sq_f = sq_y + dx;
-                                    if (is_play_area(sq_f))
-                                    {
-                                        ptr_v = engine.squares[sq_f];
-                                        if (ptr_v)
-                                        {
-                                            shape_v = ptr_v->shape;      
-                                            if (ptr_v->player != player && shape_v != KING)
-                                            {
-                                                if (on_promo_row)
-                                                    MVVLVA_insert(IS_PROMO_Q, QUEEN, ptr_v); // capture promotion is better than capture -> assume PAWN x QUEEN 
-                                                else
-                                                    MVVLVA_insert(IS_NORM, shape_v, ptr_v);
-                                            }
-                                        }
-                                    }
-                                }
+                m = &root_moves[i].move;
+                TraceScope trace_move("root_move", max_depth, LAN_of(m->tag, m->sq_i, m->sq_f));
+                child_castle_rights = glob_castle_rights;
+                child_hash = move(glob_hash, glob_player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v, child_castle_rights.data());
+                push_history(child_hash, is_reversible(m->tag, m->shape, m->ptr_v, glob_castle_rights, child_castle_rights));
+                child_score = is_repeat() ? 0 : eval(child_hash, !glob_player, 1, alpha, beta, false, is_PV_node, child_castle_rights, 0);
+                is_PV_node = false;
+                pop_history();
+                unmove(glob_player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v);
+                if (stop)
+                    break;
+                searched_cnt++;
 
-                                // y-moves
-                                sq_f = sq_y;
-                                if (!engine.squares[sq_f])
-                                {
-                                    if (on_promo_row)
-                                        MVVLVA_insert(IS_PROMO_Q, PAWN, nullptr); // quiet promotion better than quiet -> assume PAWN x PAWN
-                                    else
-                                    {
-                                        quiet_push();
+                LOG(LOG_DEBUG, '{' << LAN_of(m->tag, m->sq_i, m->sq_f) << ", " << child_score << "},");
 
-                                        if ((y_i == 1 && !player) || (y_i == 6 && player)) // on start row
-                                        {
-                                            sq_f += dy;
-                                            if (!engine.squares[sq_f])
-                                                quiet_push();
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                        else if (shape_a == KNIGHT)
-                        {
-                            for (short v: N_VECTOR)
-                            {
-                                sq_f = sq_i + v;
-                                if (is_play_area(sq_f))
-                                {
-                                    ptr_v = engine.squares[sq_f];
-                                    if (ptr_v)
-                                    {
-                                        shape_v = ptr_v->shape;
-                                        if (ptr_v->player != player && shape_v != KING)
-                                            MVVLVA_insert(IS_NORM, shape_v, ptr_v);
-                                    }
-                                    else
-                                        quiet_push();
-                                }
-                            }
-                        }
-                        else if (shape_a == KING)
-                        {
-                            for (short v: K_VECTOR)
-                            {
-                                sq_f = sq_i + v;
-                                if (is_play_area(sq_f))
-                                {
-                                    ptr_v = engine.squares[sq_f];
-                                    if (ptr_v)
-                                    {
-                                        shape_v = ptr_v->shape;
-                                        if (ptr_v->player != player && shape_v != KING)
-                                            MVVLVA_insert(IS_NORM, shape_v, ptr_v);
-                                    }
-                                    else
-                                        quiet_push();
-                                }
-                            }
-                            if (!is_QS)
-                            {
-                                short rook_sq_i = NULL;
-                                if (castle_rights[Q_SIDE])
-                                {
-                                    rook_sq_i = R_SQ_CASTLE[player][Q_SIDE];
-                                    if (engine.is_path_clear(sq_i, rook_sq_i, sq_i - rook_sq_i))
-                                    {
-                                        sq_f = sq_i - 2;
-                                        MVVLVA_insert(IS_CASTLE, PAWN, nullptr); // castle better than quiet -> assume KING x PAWN
-                                    }
-                                }
-                                if (castle_rights[K_SIDE])
-                                {
-                                    rook_sq_i = R_SQ_CASTLE[player][K_SIDE];
-                                    if (engine.is_path_clear(sq_i, rook_sq_i, rook_sq_i - sq_i))
-                                    {
-                                        sq_f = sq_i + 2;
-                                        MVVLVA_insert(IS_CASTLE, PAWN, nullptr);
-                                    }
-                                }
-                            }
-                        }
-                        else
-                        {
-                            if (shape_a == BISHOP || shape_a == QUEEN)
-                            {
-                                for (short v: B_VECTOR)
-                                {
-                                    for (sq_f = sq_i + v; is_play_area(sq_f) && !engine.squares[sq_f]; sq_f += v)
-                                        quiet_push();
-                                    
-                                    if (is_play_area(sq_f))
-                                    {
-                                        ptr_v = engine.squares[sq_f];
-                                        shape_v = ptr_v->shape;
-                                        if (ptr_v->player != player && shape_v != KING)
-                                            MVVLVA_insert(IS_NORM, shape_v, ptr_v);
-                                    }
-                                }
-                            }
-                            if (shape_a == ROOK || shape_a == QUEEN)
-                            {
-                                for (short v: R_VECTOR)
-                                {
-                                    // travel until on top of a piece
-                                    for (sq_f = sq_i + v; is_play_area(sq_f) && !engine.squares[sq_f]; sq_f += v)
-                                        quiet_push();
+                RootMove &root_move = root_moves[i];
+                root_move.score = child_score;
+                root_move.line_len = 0;
+                if (alpha < child_score && child_score < beta) // exact score
+                {
+                    root_move.line[0] = *m;
+                    std::copy(pv[1] + 1, pv[1] + pv_len[1], root_move.line + 1);
+                    root_move.line_len = std::max(pv_len[1], short(1));
+                }
+
+                // keep root_moves[0...i] sorted from best to worst
+                for (short j = i; j > 0 && is_better(glob_player, root_moves[j].score, root_moves[j-1].score); j--)
+                    std::swap(root_moves[j], root_moves[j-1]);
+            }
+            if (stop && (best_line_len || !searched_cnt))
+                break;
+
+            std::copy(root_moves[0].line, root_moves[0].line + root_moves[0].line_len, best_line);
+            best_line_len = root_moves[0].line_len;
+            score = root_moves[0].score;
+            STAT(iter_nodes[max_depth] = nodes);
+            STAT(iter_cnt = max_depth);
+            into_tree(glob_hash, 0, max_depth, SHRT_MIN, SHRT_MAX, score, TREE_ITERATION, best_line_len ? &best_line[0] : nullptr);
+
+            long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            if (on_iteration)
+                on_iteration(root_moves[0], ms);
+            else
+            {
+                std::lock_guard<std::mutex> lock(io_mutex);
+                for (short k = 0; k < std::min(pv_cnt, searched_cnt); k++)
+                {
+                    const RootMove &root_move = root_moves[k];
+                    std::cout << "info depth " << max_depth << " seldepth " << sel_depth << " multipv " << k + 1 << " score " << UCI_score_of(root_move.score, glob_player)
+                        << " nodes " << nodes << " nps " << (ms ? nodes * 1000 / ms : 0) << " hashfull " << hashfull() << " time " << ms << " pv";
+                    for (short i = 0; i < root_move.line_len; i++)
+                        std::cout << ' ' << LAN_of(root_move.line[i].tag, root_move.line[i].sq_i, root_move.line[i].sq_f);
+                    std::cout << '\n';
+                }
+                std::cout << std::flush; // one write per iteration, GUIs show progress from these lines
+            }
+
+            if (stop)
+                break;
+            if (glob_player == MAXER ? score >= SHRT_MAX - MAX_PLY : score <= SHRT_MIN + MAX_PLY) // found a forced mate
+                break;
+            if (time_budget && !is_pondering && now_ms() - clock_start >= time_budget / 2) // next iteration would not finish
+                break;
+        }
+        const Moves &best = best_line_len ? best_line[0] : root_moves[0].move;
+        tag = best.tag;
+        best_sq_i = best.sq_i;
+        best_sq_f = best.sq_f;
+    }
+
+    /**
+     * @return number of leaf positions depth plies below this position.
+     * Bulk Counting: legal moves of the last ply are counted without being played.
+     * Counts are cached in perft_table by hash and depth.
+     */
+    unsigned long long perft(unsigned long long hash, Player player, short depth, CastleRight &castle_rights)
+    {
+        if (depth <= 0)
+            return 1;
+        if (perft_table.empty())
+            perft_table.resize(PERFT_TABLE_SZ);
+
+        PerftEntry &entry = perft_table[hash & (perft_table.size() - 1)];
+        if (entry.hash == hash && entry.depth == depth)
+            return entry.cnt;
+
+        bool is_check_i = is_check(player);
+        unsigned long long cnt = 0, child_hash = NULL;
+        CastleRight child_castle_rights;
+        Moves *m = nullptr;
+        MVVLVAMoveGenerator moves(*this, player, false, castle_rights.data()[player]);
+        while ((m = moves.next()))
+        {
+            if ( will_check(player, m->sq_i, m->sq_f, m->ptr_v) ||
+                (m->tag == IS_CASTLE && !is_legal_castle(is_check_i, player, m->sq_i, m->sq_f)) )
+                continue;
+
+            if (depth == 1)
+            {
+                cnt++;
+                continue;
+            }
+            child_castle_rights = castle_rights;
+            child_hash = move(hash, player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v, child_castle_rights.data());
+            cnt += perft(child_hash, !player, depth-1, child_castle_rights);
+            unmove(player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v);
+        }
+
+        entry.hash = hash;
+        entry.cnt = cnt;
+        entry.depth = depth;
+        return cnt;
+    }
+
+    /**
+     * @return whether move is valid.
+     * 0: valid
+     * 1: illegal move vector
+     * 2: outside play area
+     * 3: empty initial square
+     * 4: impersonating bot
+     * 5: illegal capture
+     * 6: blocked path
+     * 7: illegal promotion
+     * 8: is in check before/on the path of castling
+     * 9: is in check after move
+     */
+    short validate(Tag tag, short sq_i, short sq_f)
+    {
+        if (!is_play_area(sq_i) || !is_play_area(sq_f))
+            return 2;
+
+        Piece *ptr_a = squares[sq_i],
+              *ptr_v = squares[sq_f];
+        if (!ptr_a)
+            return 3;
+
+        else if (ptr_a->player != glob_player)
+            return 4;
+
+        else if (ptr_v && (ptr_v->player == glob_player || ptr_v->shape == KING))
+            return 5;
+
+        short y_i = y_of(sq_i),
+              y_f = y_of(sq_f),
+              dx = abs(x_of(sq_f) - x_of(sq_i)),
+              dy = abs(y_f - y_i),
+              d_cheby = std::max(dx, dy);
+        
+        bool is_promo = tag <= IS_PROMO_Q;
+        Shape shape = ptr_a->shape;
+        if (shape == PAWN)
+        {
+            bool on_promo_row = (y_i == 1 && glob_player) || (y_i == 6 && !glob_player),
+                 on_start_row = (y_i == 1 && !glob_player) || (y_i == 6 && glob_player);
+
+            if (rel_forward(glob_player)*(y_f - y_i) < 0) // backward
+                return 1;
+
+            else if (!is_promo && on_promo_row)
+                return 7;
+
+            else if (is_promo && !on_promo_row)
+                return 7;
+
+            else if (!ptr_v && dx)
+                return 1;
+            
+            else if (ptr_v && dx != 1)
+                return 5;
+            
+            else if (dy > 2 && on_start_row)
+                return 1;
+            
+            else if (dy > 1 && !on_start_row)
+                return 1;
+        }
+        else if (is_promo)
+            return 9;
+
+        else if (shape == KNIGHT && (dx != 1 || dy != 2) && (dx != 2 || dy != 1))
+            return 1;
 
-                                    if (is_play_area(sq_f))
-                                    {
-                                        ptr_v = engine.squares[sq_f];
-                                        shape_v = ptr_v->shape;
-                                        if (ptr_v->player != player && shape_v != KING)
-                                            MVVLVA_insert(IS_NORM, shape_v, ptr_v);
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
+        else if (shape == BISHOP && dx != dy)
+            return 1;
+
+        else if (shape == ROOK && dx && dy)
+            return 1;
+
+        else if (shape == QUEEN && dx && dy && dx != dy)
+            return 1;
+
+        else if (shape == KING)
+        {
+            if (tag == IS_CASTLE)
+            {
+                Side side = (sq_f < sq_i) ? Q_SIDE : K_SIDE;
+
+                if (!glob_castle_rights.data()[glob_player][side])
+                    return 8;
+
+                short rook_sq_i = R_SQ_CASTLE[glob_player][side];
+                if (!is_path_clear(sq_i, rook_sq_i, abs(sq_i - rook_sq_i)))
+                    return 8;
             }
-    };
+            else if (d_cheby > 1)
+                return 1;
+        }
+
+        if (shape != KNIGHT && shape != KING && !is_path_clear(sq_i, sq_f, d_cheby))
+            return 6;
+
+        if (will_check(glob_player, sq_i, sq_f, ptr_v))
+            return 9;
+
+        // if all valid
+        return 0;
+    }
 
     /**
-     * pieces
-     * └── 0,1: see enum Player
-     *     └── 0...63
-     *         └── see struct Piece
-     * 
-     * If an piece is captured, its sq = sq - AREA
+     * @return
+     * mate_type = 0 if game continues
+     * mate_type = 1 if bot is checkmated
+     * mate_type = 2 if bot is stalemated
      */
-    Piece pieces[MAX_PLAYER][MAX_PIECES];
-    /** 
-     * squares
-     * ├── columns 8,9 element
-     * │   └── nullptr as sentinel
-     * │
-     * └── columns 0...8 element
-     *     └── pointer to a piece in the pieces[], else nullptr as empty square.
-     * 
-     * The squares is 10x8 since the two rightmost columns are sentinels that prevent
-     * iterators from "wrapping" onto the previous/next row. Sentinels/empties are nullptr to identify easily using !squares[sq].
+    std::string mate_type()
+    {
+        Moves *m = nullptr;
+        bool is_check_i = is_check(glob_player);
+        MVVLVAMoveGenerator moves(*this, glob_player, false, glob_castle_rights.data()[glob_player]);
+        while((m = moves.next()) && (will_check(glob_player, m->sq_i, m->sq_f, m->ptr_v) ||
+            (m->tag == IS_CASTLE && !is_legal_castle(is_check_i, glob_player, m->sq_i, m->sq_f)) ));
+        if (!m)
+        {
+            if (is_check_i)
+                if (glob_player == BOT)
+                    return "You win!";
+                else
+                    return "You lost!";
+            else
+                return "Stalemate!";
+        }
+        return "";
+    }
+
+    /**
+     * @return whether the game is drawn by threefold repetition, the fifty-move rule or insufficient material (no pawn and at most one minor piece).
+     * The fifty-move count also restarts on castling and loss of castle rights, since it is rev_cnt.
      */
-    Piece *squares[AREA];
-    Piece *KING_PTR[MAX_PLAYER];
-    CastleRight glob_castle_rights;
+    bool is_draw()
+    {
+        const HistoryEntry &entry = history.back();
+        if (entry.rev_cnt >= 100)
+            return true;
 
-    Player glob_player;
-    unsigned long long glob_hash;
-    TtableEntry ttable[TABLE_SZ]; // Transposition Table
+        short cnt = 0;
+        for (int i = int(history.size()) - 5; i >= int(history.size()) - 1 - entry.rev_cnt && i >= 0; i -= 2)
+            if (history[i].hash == entry.hash && ++cnt == 2)
+                return true;
 
-    short root_depth; // move counter, but only update when bot move
-    unsigned long long ancestors[MAX_DEPTH];
+        if (phase > SHAPE_PHASE[KNIGHT])
+            return false;
+        for (short player = BOT; player <= HUMAN; player++)
+            for (const Piece &piece : pieces[player])
+                if (piece.is_alive() && piece.shape == PAWN)
+                    return false;
+        return true;
+    }
 
-    short phase; // sum of SHAPE_PHASE of all current pieces
-    short psv_opening[MAX_PLAYER];
-    short psv_endgame[MAX_PLAYER];
+    /**
+     * @return legal moves of glob_player, pointing into pieces[].
+     */
+    std::vector<Moves> legal_moves()
+    {
+        std::vector<Moves> legal;
+        bool is_check_i = is_check(glob_player);
+        Moves *m = nullptr;
+        MVVLVAMoveGenerator moves(*this, glob_player, false, glob_castle_rights.data()[glob_player]);
+        while ((m = moves.next()))
+            if (!( will_check(glob_player, m->sq_i, m->sq_f, m->ptr_v) ||
+                  (m->tag == IS_CASTLE && !is_legal_castle(is_check_i, glob_player, m->sq_i, m->sq_f)) ))
+                legal.push_back(*m);
+        return legal;
+    }
 
-    inline void parse_LAN(const std::string &LAN, Tag &tag, short &sq_i, short &sq_f)
+    /**
+     * @return key of the current position in Polyglot opening books, see POLYGLOT_RANDOM.
+     * Computed from scratch rather than kept with glob_hash, since only the root is ever looked up.
+     */
+    unsigned long long polyglot_key() const
     {
-        sq_i = (PLAY_WIDTH - (LAN[1] - '0'))*WIDTH + (LAN[0] - 'a');
-        sq_f = (PLAY_WIDTH - (LAN[3] - '0'))*WIDTH + (LAN[2] - 'a');
-        if (LAN.length() == 5)
+        unsigned long long key = 0;
+        for (short player = BOT; player <= HUMAN; player++)
         {
-            switch(toupper(LAN[4]))
-            {
-                case 'N':
-                    tag = IS_PROMO_N;
-                    break;
-                case 'B':
-                    tag = IS_PROMO_B;
-                    break;
-                case 'R':
-                    tag = IS_PROMO_R;
-                    break;
-                case 'Q':
-                    tag = IS_PROMO_Q;
-                    break;
-                default:
-                    tag = IS_NORM;
+            for (const Piece &piece : pieces[player])
+                if (piece.is_alive())
+                    key ^= POLYGLOT_RANDOM[64*(2*piece.shape + player) + 8*(PLAY_WIDTH-1 - y_of(piece.sq)) + x_of(piece.sq)];
+            for (short side = Q_SIDE; side <= K_SIDE; side++)
+                if (glob_castle_rights.data()[player][side])
+                    key ^= POLYGLOT_RANDOM[POLYGLOT_CASTLE + 2*(player == BOT) + (side == Q_SIDE)];
+        }
+        if (ep_x >= 0)
+        {
+            short sq = (glob_player == HUMAN ? 3 : 4)*WIDTH + ep_x; // the pawn that just moved 2 squares
+            for (short sq_a : {short(sq - 1), short(sq + 1)}) // sentinel columns are nullptr
+                if (squares[sq_a] && squares[sq_a]->player == glob_player && squares[sq_a]->shape == PAWN)
+                {
+                    key ^= POLYGLOT_RANDOM[POLYGLOT_EP + ep_x];
                     break;
-            }
+                }
         }
-        else if (squares[sq_i] && squares[sq_i]->shape == KING && abs(sq_f - sq_i) == 2)
-            tag = IS_CASTLE;
-        else
-            tag = IS_NORM;
+        if (glob_player == HUMAN)
+            key ^= POLYGLOT_RANDOM[POLYGLOT_TURN];
+        return key;
     }
 
     /**
-     * IMPORTANT: Custom FEN must be validated beforehand!
-     * Last 2 fields of FEN (en passant targets, move counters) are ignored.
+     * @return move of a legal move m of glob_player as in Polyglot opening books, see struct Book.
      */
-    Engine()
+    unsigned short polyglot_move_of(const Moves &m) const
     {
-        clear();
-        load();
+        short sq_f = (m.tag == IS_CASTLE) ? R_SQ_CASTLE[glob_player][m.sq_f > m.sq_i] : m.sq_f;
+        return (unsigned short)(x_of(sq_f) | (PLAY_WIDTH-1 - y_of(sq_f)) << 3 |
+                                x_of(m.sq_i) << 6 | (PLAY_WIDTH-1 - y_of(m.sq_i)) << 9 |
+                                (m.tag <= IS_PROMO_Q ? m.tag : 0) << 12);
     }
 
-    void clear()
+    /**
+     * Pick a move of the current position from book, at random by the weights of its legal entries.
+     * The random generator is seeded by the key, so the same position always gets the same move.
+     * @return false if book is disabled or has no legal move for the position.
+     */
+    bool book_move(Tag &tag, short &sq_i, short &sq_f)
     {
-        for (short player = BOT; player <= HUMAN; player++)
+        if (!book.is_enabled || !book.size())
+            return false;
+        unsigned long long key = polyglot_key();
+        std::vector<Moves> legal = legal_moves();
+        std::vector<std::pair<Moves, unsigned short>> candidates; // legal moves of the entries and their weights
+        unsigned int weight_sum = 0;
+        for (size_t i = book.find(key); i < book.size() && book.key_at(i) == key; i++)
         {
-            for (Piece &piece : pieces[player])
-                piece = Piece();
-            KING_PTR[player] = nullptr;
-            for (short side = Q_SIDE; side <= K_SIDE; side++)
-                glob_castle_rights.data()[player][side] = false;
-            psv_opening[player] = 0;
-            psv_endgame[player] = 0;
+            unsigned short move = book.move_at(i), weight = book.weight_at(i);
+            for (const Moves &m : legal)
+                if (weight && polyglot_move_of(m) == move)
+                {
+                    candidates.emplace_back(m, weight);
+                    weight_sum += weight;
+                    break;
+                }
         }
-        for (Piece *&sq : squares)
-            sq = nullptr;
-        glob_player = HUMAN;
-        glob_hash = 0;
-        root_depth = 0;
-        for (unsigned long long &hash : ancestors)
-            hash = 0;
-        phase = 0;
+        if (!weight_sum)
+            return false;
+
+        std::mt19937 pick_gen{unsigned(key)};
+        unsigned int pick = pick_gen() % weight_sum;
+        for (const auto &[m, weight] : candidates)
+        {
+            if (pick < weight)
+            {
+                tag = m.tag;
+                sq_i = m.sq_i;
+                sq_f = m.sq_f;
+                break;
+            }
+            pick -= weight;
+        }
+        best_line_len = 0; // no ponder move
+        return true;
     }
 
-    void load(const std::string &FEN = DEFAULT_FEN)
+    /**
+     * @param legal - legal_moves() of the current position, to disambiguate m
+     * @return Standard Algebraic Notation of the legal move m, with "+" or "#" if it checks or mates.
+     */
+    std::string SAN_of(const Moves &m, const std::vector<Moves> &legal)
     {
-        char ch = NULL;
-        short sq = 0, i = 0;
-        Player player;
-        Shape shape;
+        std::string SAN = "";
+        if (m.tag == IS_CASTLE)
+            SAN = (m.sq_f > m.sq_i) ? "O-O" : "O-O-O";
+        else
+        {
+            if (m.shape != PAWN)
+            {
+                SAN += char_of[HUMAN][m.shape];
+                bool is_ambiguous = false, is_same_file = false, is_same_rank = false;
+                for (const Moves &other : legal)
+                {
+                    if (other.shape != m.shape || other.sq_f != m.sq_f || other.sq_i == m.sq_i)
+                        continue;
+                    is_ambiguous = true;
+                    is_same_file |= x_of(other.sq_i) == x_of(m.sq_i);
+                    is_same_rank |= y_of(other.sq_i) == y_of(m.sq_i);
+                }
+                if (is_ambiguous && (!is_same_file || is_same_rank))
+                    SAN += file_of(m.sq_i);
+                if (is_same_file)
+                    SAN += rank_of(m.sq_i);
+            }
+            else if (m.ptr_v)
+                SAN += file_of(m.sq_i);
+
+            if (m.ptr_v)
+                SAN += 'x';
+            SAN += file_of(m.sq_f);
+            SAN += rank_of(m.sq_f);
+            if (m.tag <= IS_PROMO_Q)
+                (SAN += '=') += char_of[HUMAN][m.tag];
+        }
+
+        CastleRight child_castle_rights = glob_castle_rights;
+        move(glob_hash, glob_player, m.tag, m.shape, m.sq_i, m.sq_f, m.ptr_v, child_castle_rights.data());
+        if (is_check(!glob_player))
+        {
+            Moves *reply = nullptr;
+            MVVLVAMoveGenerator replies(*this, !glob_player, false, child_castle_rights.data()[!glob_player]);
+            while ((reply = replies.next()) &&
+                   ( will_check(!glob_player, reply->sq_i, reply->sq_f, reply->ptr_v) ||
+                    (reply->tag == IS_CASTLE && !is_legal_castle(true, !glob_player, reply->sq_i, reply->sq_f)) )); // filtered as in legal_moves()
+            SAN += reply ? '+' : '#';
+        }
+        unmove(glob_player, m.tag, m.shape, m.sq_i, m.sq_f, m.ptr_v);
+        return SAN;
+    }
 
-        // FEN field 1
-        for (; FEN[i] != ' '; i++)
+    /**
+     * Parse a move in Standard Algebraic Notation, also accepting redundant disambiguation, missing "x" or "=", "0-0" and annotations ("+", "!?").
+     * @return whether SAN is exactly one legal move, which is then stored in m.
+     */
+    bool parse_SAN(std::string_view SAN, Moves &m)
+    {
+        while (!SAN.empty() && std::string_view("+#!?").find(SAN.back()) != std::string_view::npos)
+            SAN.remove_suffix(1);
+        // only the pseudo-legal moves matching SAN are checked for legality, as in legal_moves()
+        bool is_check_i = is_check(glob_player);
+        Moves *candidate = nullptr;
+        MVVLVAMoveGenerator moves(*this, glob_player, false, glob_castle_rights.data()[glob_player]);
+        auto is_legal = [&]()
         {
-            ch = FEN[i];
-            if (isdigit(ch))
-                sq += ch - '0';
+            return !( will_check(glob_player, candidate->sq_i, candidate->sq_f, candidate->ptr_v) ||
+                     (candidate->tag == IS_CASTLE && !is_legal_castle(is_check_i, glob_player, candidate->sq_i, candidate->sq_f)) );
+        };
 
-            else if (isalpha(ch))
-            {
-                player = Player(bool(isupper(ch))); // cast to bool since isupper returns non-zero for uppercase
-                switch (toupper(ch))
+        if (SAN == "O-O" || SAN == "0-0" || SAN == "O-O-O" || SAN == "0-0-0")
+        {
+            while ((candidate = moves.next()))
+                if (candidate->tag == IS_CASTLE && (candidate->sq_f > candidate->sq_i) == (SAN.size() == 3) && is_legal())
                 {
-                    case 'P':
-                        shape = PAWN;
-                        break;
-                    case 'N':
-                        shape = KNIGHT;
-                        break;
-                    case 'B':
-                        shape = BISHOP;
-                        break;
-                    case 'R':
-                        shape = ROOK;
-                        break;
-                    case 'Q':
-                        shape = QUEEN;
-                        break;
-                    case 'K':
-                        shape = KING;
-                        break;
+                    m = *candidate;
+                    return true;
                 }
+            return false;
+        }
 
-                // find in pieces[]
-                Piece *my_pieces = pieces[player];
-                short i = 0;
-                for (; i < MAX_PIECES && shape >= my_pieces[i].shape; i++) // pieces[] is sorted with ascending shape, then sq
-                {}
+        Shape shape = PAWN;
+        if (!SAN.empty() && std::string_view("NBRQK").find(SAN[0]) != std::string_view::npos)
+        {
+            shape = Shape(std::string_view("PNBRQK").find(SAN[0]));
+            SAN.remove_prefix(1);
+        }
 
-                if (my_pieces[i].is_alive())
-                    // move elements at/after i back by 1
-                    for (short ii = MAX_PIECES-1; ii > i; ii--)
-                        my_pieces[ii] = my_pieces[ii-1];
+        Tag tag = IS_NORM;
+        if (shape == PAWN && SAN.size() >= 3 && std::string_view("NBRQnbrq").find(SAN.back()) != std::string_view::npos &&
+            (SAN[SAN.size() - 2] == '=' || isdigit(SAN[SAN.size() - 2])))
+        {
+            tag = Tag(std::string_view("PNBRQ").find(char(toupper(SAN.back()))));
+            SAN.remove_suffix(SAN[SAN.size() - 2] == '=' ? 2 : 1);
+        }
 
-                my_pieces[i].player = player;
-                my_pieces[i].shape = shape;
-                my_pieces[i].sq = sq;
-                sq++;
-            }
-            else if (ch == '/')
-                sq += SENTL_WIDTH;
+        if (SAN.size() < 2 || SAN[SAN.size() - 2] < 'a' || SAN[SAN.size() - 2] > 'h' || SAN.back() < '1' || SAN.back() > '8')
+            return false;
+        short sq_f = (PLAY_WIDTH - (SAN.back() - '0'))*WIDTH + (SAN[SAN.size() - 2] - 'a'),
+              x_i = -1, y_i = -1;
+        SAN.remove_suffix(2);
+        for (char ch : SAN)
+        {
+            if ('a' <= ch && ch <= 'h')
+                x_i = ch - 'a';
+            else if ('1' <= ch && ch <= '8')
+                y_i = PLAY_WIDTH - (ch - '0');
+            else if (ch != 'x' && ch != '-' && ch != ':')
+                return false;
         }
-        i++;
 
-        // FEN field 2
-        switch (toupper(FEN[i]))
+        short match_cnt = 0;
+        while ((candidate = moves.next()))
         {
-            case 'B':
-                glob_player = BOT;
-                glob_hash ^= ZPLAYER;
-                break;
+            if (candidate->shape == shape && candidate->sq_f == sq_f && (candidate->tag <= IS_PROMO_Q ? candidate->tag : IS_NORM) == tag &&
+                (x_i < 0 || x_of(candidate->sq_i) == x_i) && (y_i < 0 || y_of(candidate->sq_i) == y_i) && is_legal())
+            {
+                m = *candidate;
+                match_cnt++;
+            }
         }
-        i += 2;
+        return match_cnt == 1;
+    }
+};
+
+void console_play()
+{
+    static Engine engine;
+    std::cout << "===========================================" << '\n'
+        << "            SIGMA4 UCI CHESSBOT" << '\n'
+        << "              by RandomKerbal" << '\n'
+        << "===========================================" << "\n\n"
+        << "En passant is not supported!" << "\n\n"
+        << "What is the UCI long algebraic notation (e.g. e2e4, g7g8q)?" << '\n'
+        << "https://en.wikipedia.org/wiki/Algebraic_notation_(chess)#Long_algebraic_notation" << "\n\n"
+        << "Starter: " << (engine.glob_player ? "HUMAN" : "BOT") << "\n\n";
 
-        // FEN field 3
-        for (; FEN[i] != ' '; i++)
+    std::string LAN = "";
+    Tag tag = IS_NORM;
+    short sq_i = NULL, sq_f = NULL, error_type = NULL;
+    while (engine.mate_type() == "")
+    {
+        if (engine.glob_player) // HUMAN
         {
-            ch = FEN[i];
-            player = Player(bool(isupper(ch)));
-            switch (toupper(ch))
+            std::cout << engine;
+            do
             {
-                case 'Q':
-                    glob_castle_rights.data()[player][Q_SIDE] = true;
-                    glob_hash ^= ZCASTLE[player][Q_SIDE];
-                    break;
-                case 'K':
-                    glob_castle_rights.data()[player][K_SIDE] = true;
-                    glob_hash ^= ZCASTLE[player][K_SIDE];
-                    break;
+                std::cout << "Input UCI long algebraic notation: ";
+                std::getline(std::cin, LAN);
+                engine.parse_LAN(LAN, tag, sq_i, sq_f);
+                error_type = engine.validate(tag, sq_i, sq_f);
+                if (error_type)
+                    std::cout << "Invalid move, broken rule #" << error_type << '\n';
             }
+            while (error_type);
+            engine.play(tag, sq_i, sq_f);
+            std::cout << engine.mate_type() << '\n';
+        }
+        else // BOT
+        {
+            engine.root_eval(tag, sq_i, sq_f);
+            engine.play(tag, sq_i, sq_f);
+            std::cout << '\n' << "Chosen: " << LAN_of(tag, sq_i, sq_f) << '\n';
+#ifdef SEARCH_STATS
+            engine.stats.print(std::cout, engine.nodes);
+#endif
+            std::cout << engine.mate_type() << '\n';
         }
+        logger.flush(); // end of turn
+    }
+    std::cout << engine;
+}
 
-        root_depth = (glob_player == HUMAN);
-        for (short player = BOT; player <= HUMAN; player++)
+/**
+ * Split a UCI "setoption name <name> value <value>" command.
+ */
+inline void parse_setoption(std::string_view cmd, std::string_view &name, std::string_view &value)
+{
+    size_t name_at = cmd.find(" name "), value_at = cmd.find(" value ");
+    name = (name_at == std::string_view::npos) ? std::string_view() : cmd.substr(name_at + 6, value_at - (name_at + 6));
+    value = (value_at == std::string_view::npos) ? std::string_view() : cmd.substr(value_at + 7);
+}
+
+/**
+ * @return the limits of a UCI "go" command.
+ */
+SearchLimits parse_go(const std::string &cmd)
+{
+    SearchLimits limits;
+    std::istringstream tokens(cmd);
+    std::string token = "";
+    tokens >> token; // "go" or "bench"
+    while (tokens >> token)
+    {
+        if (token == "depth")
+            tokens >> limits.depth;
+        else if (token == "movetime")
+            tokens >> limits.movetime;
+        else if (token == "wtime")
+            tokens >> limits.time[HUMAN];
+        else if (token == "btime")
+            tokens >> limits.time[BOT];
+        else if (token == "winc")
+            tokens >> limits.inc[HUMAN];
+        else if (token == "binc")
+            tokens >> limits.inc[BOT];
+        else if (token == "movestogo")
+            tokens >> limits.movestogo;
+        else if (token == "nodes")
+            tokens >> limits.nodes;
+        else if (token == "infinite")
+            limits.infinite = true;
+        else if (token == "ponder")
+            limits.ponder = true;
+    }
+    return limits;
+}
+
+/**
+ * Count leaf positions depth plies below the current position of engine.
+ * Root moves are split between threads, each owning a copy of the position loaded from engine.FEN() and its own perft_table.
+ * @return the total, and by reference the legal root moves and the count below each.
+ */
+unsigned long long parallel_perft(Engine &engine, short depth, std::vector<Moves> &root_moves, std::vector<unsigned long long> &cnts)
+{
+    root_moves.clear();
+    {
+        bool is_check_i = engine.is_check(engine.glob_player);
+        Moves *m = nullptr;
+        Engine::MVVLVAMoveGenerator moves(engine, engine.glob_player, false, engine.glob_castle_rights.data()[engine.glob_player]);
+        while ((m = moves.next()))
+            if (!( engine.will_check(engine.glob_player, m->sq_i, m->sq_f, m->ptr_v) ||
+                  (m->tag == IS_CASTLE && !engine.is_legal_castle(is_check_i, engine.glob_player, m->sq_i, m->sq_f)) ))
+                root_moves.push_back(*m);
+    }
+
+    cnts.assign(root_moves.size(), depth <= 0 ? 0 : 1);
+    if (depth > 1)
+    {
+        const std::string FEN = engine.FEN();
+        std::atomic<size_t> next_i{0};
+        auto work = [&]()
         {
-            // load KING_PTR, NBRQ_BEGIN, NBRQ_END, squares, hash, MAX_PHASE, phase, psv_opening, psv_endgame
-            for (Piece &piece : pieces[player])
+            std::unique_ptr<Engine> worker = std::make_unique<Engine>(1); // no search, so a 1 entry transposition table
+            worker->clear();
+            worker->load(FEN);
+            Piece *ptr_v = nullptr;
+            CastleRight child_castle_rights;
+            unsigned long long child_hash = NULL;
+            for (size_t i = next_i++; i < root_moves.size(); i = next_i++)
             {
-                if (piece.is_alive())
-                {
-                    sq = piece.sq;
-                    shape = piece.shape;
-                    squares[sq] = &piece;
+                const Moves &m = root_moves[i];
+                TraceScope trace_move("perft_root_move", depth, LAN_of(m.tag, m.sq_i, m.sq_f));
+                ptr_v = worker->squares[m.sq_f]; // root_moves point into engine.pieces[]
+                child_castle_rights = worker->glob_castle_rights;
+                child_hash = worker->move(worker->glob_hash, worker->glob_player, m.tag, m.shape, m.sq_i, m.sq_f, ptr_v, child_castle_rights.data());
+                cnts[i] = worker->perft(child_hash, !worker->glob_player, depth-1, child_castle_rights);
+                worker->unmove(worker->glob_player, m.tag, m.shape, m.sq_i, m.sq_f, ptr_v);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        size_t thread_cnt = std::min(size_t(std::max(1u, std::thread::hardware_concurrency())), root_moves.size());
+        for (size_t i = 0; i < thread_cnt; i++)
+            threads.emplace_back(work);
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    unsigned long long total = (depth <= 0) ? 1 : 0;
+    for (unsigned long long cnt : cnts)
+        total += cnt;
+    return total;
+}
+
+/**
+ * UCI extension "perft depth" / "divide depth": count leaf positions of the current position, divide also prints the count below each root move.
+ */
+void uci_perft(Engine &engine, short depth, bool is_divide)
+{
+    std::vector<Moves> root_moves;
+    std::vector<unsigned long long> cnts;
+    long long start = now_ms();
+    unsigned long long total = parallel_perft(engine, depth, root_moves, cnts);
+    long long time = now_ms() - start;
+    if (tracer.is_enabled)
+        tracer.dump();
+
+    std::lock_guard<std::mutex> lock(io_mutex);
+    if (is_divide)
+        for (size_t i = 0; i < root_moves.size(); i++)
+            std::cout << LAN_of(root_moves[i].tag, root_moves[i].sq_i, root_moves[i].sq_f) << ": " << cnts[i] << '\n';
+    std::cout << '\n' << "Nodes searched: " << total << '\n'
+        << "Time: " << time << " ms, " << std::fixed << std::setprecision(2) << total / 1000.0 / std::max(time, 1LL) << " Mnps" << '\n';
+    std::cout.unsetf(std::ios::fixed);
+}
 
-                    if (shape == KING)
-                        KING_PTR[player] = &piece;
+struct PerftReference
+{
+    const char *FEN;
+    short depth;
+    unsigned long long cnt;
+};
 
-                    glob_hash ^= ZTABLE[player][shape][sq];
-                    phase += SHAPE_PHASE[shape];
-                    psv_opening[player] += PST_OPENING[player][shape][sq];
-                    psv_endgame[player] += PST_ENDGAME[player][shape][sq];
-                }
-            }
+/**
+ * Perft counts of the reference positions of https://www.chessprogramming.org/Perft_Results,
+ * minus the en passant captures and underpromotions that Engine does not generate.
+ * Depths are chosen so that those moves only occur at the last ply, where the adjusted count is exact.
+ */
+const PerftReference PERFT_REFERENCES[] = {
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865351}, // 4865609 - 258 e.p.
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 2, 2038}, // 2039 - 1 e.p.
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 3, 2810}, // 2812 - 2 e.p.
+    {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 1, 41}, // 44 - 3 underpromotions
+    {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594},
+};
+
+/**
+ * UCI extension and command line mode "perft check": perft every PERFT_REFERENCES position and compare with its count.
+ * @return whether all counts match, a mismatch is also logged as an error.
+ */
+bool perft_check()
+{
+    std::unique_ptr<Engine> engine = std::make_unique<Engine>(1); // no search, so a 1 entry transposition table
+    std::vector<Moves> root_moves;
+    std::vector<unsigned long long> cnts;
+    bool is_passed = true;
+    for (const PerftReference &reference : PERFT_REFERENCES)
+    {
+        engine->clear();
+        engine->load(reference.FEN);
+        unsigned long long cnt = parallel_perft(*engine, reference.depth, root_moves, cnts);
+        if (cnt != reference.cnt)
+        {
+            is_passed = false;
+            LOG(LOG_ERROR, "perft " << reference.depth << " of " << reference.FEN << " is " << cnt << ", expected " << reference.cnt);
         }
+        std::lock_guard<std::mutex> lock(io_mutex);
+        std::cout << (cnt == reference.cnt ? "ok       " : "MISMATCH ") << "depth " << reference.depth << ' ' << std::setw(10) << cnt
+            << " expected " << std::setw(10) << reference.cnt << "  " << reference.FEN << '\n';
     }
+    std::lock_guard<std::mutex> lock(io_mutex);
+    std::cout << "perft check " << (is_passed ? "passed" : "FAILED") << '\n' << std::flush;
+    return is_passed;
+}
 
-    inline void add_psv(Player player, Shape shape, short sq)
+/**
+ * Positions searched by bench, from the opening to the endgame.
+ */
+const std::string BENCH_FENS[] = {
+    DEFAULT_FEN,
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/8 b - - 3 54",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+};
+const short BENCH_DEPTH = 6;
+
+/**
+ * "bench [depth n] [nodes n] [tree path]": search every BENCH_FENS position on a fresh engine and print total nodes, time and nps.
+ * Without limits, every position is searched to BENCH_DEPTH. With tree, the search trees of all positions are dumped to path.
+ * The search is deterministic, so the node total is a signature of the search behavior and nps of the speed of the build.
+ */
+void bench(const std::string &cmd)
+{
+    SearchLimits limits = parse_go(cmd);
+    if (cmd.find(" depth ") == std::string::npos && !limits.nodes)
+        limits.depth = BENCH_DEPTH;
+
+    std::unique_ptr<Engine> engine = std::make_unique<Engine>();
+    size_t tree_at = cmd.find(" tree ");
+    if (tree_at != std::string::npos)
     {
-        psv_opening[player] += PST_OPENING[player][shape][sq];
-        psv_endgame[player] += PST_ENDGAME[player][shape][sq];
+        std::string_view rest = std::string_view(cmd).substr(tree_at + 6);
+        engine->tree.path = std::string(next_token(rest));
+        if (!engine->tree.open())
+            LOG(LOG_ERROR, "could not open " << engine->tree.path);
     }
-
-    inline void del_psv(Player player, Shape shape, short sq)
+    Tag tag = IS_NORM;
+    short sq_i = NULL, sq_f = NULL;
+    unsigned long long nodes = 0;
+    long long start = now_ms();
+#if defined(PERF_COUNTERS) && defined(__linux__)
+    perf_counters.start();
+#endif
+    for (const std::string &FEN : BENCH_FENS)
     {
-        psv_opening[player] -= PST_OPENING[player][shape][sq];
-        psv_endgame[player] -= PST_ENDGAME[player][shape][sq];
+        engine->clear();
+        engine->load(FEN);
+        std::fill(engine->ttable.begin(), engine->ttable.end(), TtableEntry());
+        engine->limits = limits;
+        engine->stop = false;
+        engine->root_eval(tag, sq_i, sq_f);
+        nodes += engine->nodes;
     }
+    long long time = std::max(now_ms() - start, 1LL);
+#if defined(PERF_COUNTERS) && defined(__linux__)
+    perf_counters.stop();
+#endif
+    if (tracer.is_enabled)
+        tracer.dump();
+    engine->tree.close();
+
+    std::lock_guard<std::mutex> lock(io_mutex);
+    std::cout << '\n'
+        << "Total time (ms) : " << time << '\n'
+        << "Nodes searched  : " << nodes << '\n'
+        << "Nodes/second    : " << nodes * 1000 / time << '\n';
+#if defined(PERF_COUNTERS) && defined(__linux__)
+    perf_counters.report(std::cout);
+#endif
+    std::cout << std::flush;
+    logger.flush();
+}
+
+const long long WORKER_MOVETIME = 1000; // ms per position (per move in match) of epd, batch and match if given no limit
+const size_t WORKER_TABLE_SZ = 1 << 20; // transposition table entries of each epd, batch and match engine unless given hash, must be power of 2
+
+/**
+ * Options of the modes that search many positions on a pool of workers: "... [movetime ms] [depth n] [nodes n] [threads n] [hash MB] [PARAM value]".
+ * Without limits, every position is searched for WORKER_MOVETIME. Every worker has a hash MB transposition table (rounded down to a power of 2).
+ * PARAM is the name of a PARAMS entry, e.g. "NM_R 2".
+ */
+struct WorkerOptions
+{
+    SearchLimits limits;
+    SearchParams params;
+    size_t thread_cnt = std::max(1u, std::thread::hardware_concurrency());
+    size_t ttable_sz = WORKER_TABLE_SZ;
 
     /**
-     * @return the new hash after the move.
-     * @return by reference the child's castle rights.
+     * @param default_nodes - nodes per search instead of WORKER_MOVETIME if cmd has no limit
      */
-    inline unsigned long long move(unsigned long long hash, Player player, Tag tag, Shape shape, short sq_i, short sq_f, Piece *ptr_v, bool castle_rights[MAX_PLAYER][2])
+    WorkerOptions(const std::string &cmd, unsigned long long default_nodes = 0) : limits(parse_go(cmd))
     {
-        Piece *ptr_a = squares[sq_i];
-
-        // capture
-        if (ptr_v)
-        {
-            ptr_v->kill();
-
-            Shape shape_v = ptr_v->shape;
-            phase -= SHAPE_PHASE[shape_v];
-            del_psv(!player, shape_v, sq_f);
-            hash ^= ZTABLE[!player][shape_v][sq_f];
-        }
-
-        // promotion
-        if (tag <= IS_PROMO_Q)
-        {
-            Shape shape_promo = Shape(tag);
-            ptr_a->shape = shape_promo;
-            phase += SHAPE_PHASE[shape_promo]; // no need to subtract SHAPE_PHASE[PAWN] that is 0
-            add_psv(player, shape_promo, sq_f);
-            hash ^= ZTABLE[player][shape_promo][sq_f];
-        }
-        else
-        {
-            add_psv(player, shape, sq_f);
-            hash ^= ZTABLE[player][shape][sq_f];
-        }
-
-        // castle
-        if (tag == IS_CASTLE)
+        if (cmd.find(" depth ") == std::string::npos && !limits.movetime && !limits.nodes)
         {
-            short rook_sq_i = NULL, rook_sq_f = NULL;
-            if (sq_f < sq_i) // queenside
-            {
-                rook_sq_i = R_SQ_CASTLE[player][Q_SIDE];
-                rook_sq_f = sq_f + 1;
-            }
-            else // kingside
-            {
-                rook_sq_i = R_SQ_CASTLE[player][K_SIDE];
-                rook_sq_f = sq_f - 1;
-            }
-            Piece *rook_ptr = squares[rook_sq_i];
-            rook_ptr->sq = rook_sq_f;
-            squares[rook_sq_f] = rook_ptr;
-            squares[rook_sq_i] = nullptr;
-
-            del_psv(player, ROOK, rook_sq_i);
-            hash ^= ZTABLE[player][ROOK][rook_sq_i];
-            add_psv(player, ROOK, rook_sq_f);
-            hash ^= ZTABLE[player][ROOK][rook_sq_f];
+            if (default_nodes)
+                limits.nodes = default_nodes;
+            else
+                limits.movetime = WORKER_MOVETIME;
         }
 
-        ptr_a->sq = sq_f;
-        squares[sq_f] = ptr_a;
-        squares[sq_i] = nullptr;
-        del_psv(player, shape, sq_i);
-        hash ^= ZTABLE[player][shape][sq_i];
-        hash ^= ZPLAYER;
-
-        // update castle rights
-        if (castle_rights)
+        std::istringstream tokens(cmd);
+        std::string token = "";
+        while (tokens >> token)
         {
-            // I can castle previously && I didn't move KING && I didn't move ROOK of the given side
-            if (castle_rights[player][Q_SIDE] && (shape == KING || sq_i == R_SQ_CASTLE[player][Q_SIDE]))
-            {
-                castle_rights[player][Q_SIDE] = false;
-                hash ^= ZCASTLE[player][Q_SIDE];
-            }
-            if (castle_rights[player][K_SIDE] && (shape == KING || sq_i == R_SQ_CASTLE[player][K_SIDE]))
+            if (token == "threads")
             {
-                castle_rights[player][K_SIDE] = false;
-                hash ^= ZCASTLE[player][K_SIDE];
+                tokens >> thread_cnt;
+                thread_cnt = std::max(thread_cnt, size_t(1));
             }
-            // opponent can castle previously && I didn't capture opponent's rook
-            if (castle_rights[!player][Q_SIDE] && sq_f == R_SQ_CASTLE[!player][Q_SIDE])
+            else if (token == "hash")
             {
-                castle_rights[!player][Q_SIDE] = false;
-                hash ^= ZCASTLE[!player][Q_SIDE];
+                size_t MB = 0;
+                tokens >> MB;
+                for (ttable_sz = 1; ttable_sz * 2 * sizeof(TtableEntry) <= (MB << 20); ttable_sz *= 2)
+                {}
             }
-            if (castle_rights[!player][K_SIDE] && sq_f == R_SQ_CASTLE[!player][K_SIDE])
+            else if (const Param *param = param_of(token))
             {
-                castle_rights[!player][K_SIDE] = false;
-                hash ^= ZCASTLE[!player][K_SIDE];
+                short value = param->default_value;
+                tokens >> value;
+                params.*param->value = std::max(param->min, std::min(value, param->max));
             }
         }
-        return hash;
     }
+};
 
-    /**
-     * IMPORTANT:
-     * 1. Doesn't undo hash
-     * 2. Same sq_i & sq_f as in move()
-     * 3. Same shape as before promotion (promoted QUEEN still has shape PAWN)
-     */
-    inline void unmove(Player player, Tag tag, Shape shape, short sq_i, short sq_f, Piece *ptr_v)
+/**
+ * @return whether Engine::load() can load FEN, see parse_FEN().
+ */
+bool is_loadable_FEN(std::string_view FEN)
+{
+    PackedPosition pos;
+    return parse_FEN(FEN, pos);
+}
+
+/**
+ * A position of an EPD test suite: FEN fields 1-4 followed by operations, e.g.
+ * 2rr3k/pp3pp1/1nnqbN1p/3pN3/2pP4/2P3Q1/PPB4P/R4RK1 w - - bm Qg6; id "WAC.001";
+ * The position is solved if the engine's move is one of the "bm" (best moves) and none of the "am" (avoid moves).
+ */
+struct EPDEntry
+{
+    std::string id = "", FEN = "";
+    std::vector<std::string> best_moves, avoid_moves; // SAN
+
+    std::string found = "-"; // SAN of the engine's move
+    bool is_solved = false;
+    long long solved_ms = -1; // time-to-solution: end of the first iteration from which every iteration chose a correct move, -1 if not solved
+    unsigned long long nodes = 0;
+};
+
+/**
+ * @return whether line is a loadable EPD position with at least one bm or am operation.
+ */
+bool parse_EPD(const std::string &line, EPDEntry &entry)
+{
+    std::string_view rest = line, field;
+    for (short i = 0; i < 4; i++)
     {
-        Piece *ptr_a = squares[sq_f];
+        field = next_token(rest);
+        if (field.empty())
+            return false;
+        entry.FEN += std::string(field) + (i < 3 ? " " : " 0 1");
+    }
+    if (!is_loadable_FEN(entry.FEN))
+        return false;
 
-        // demotion
-        if (tag <= IS_PROMO_Q)
+    std::string_view operation, opcode, operand;
+    while (!rest.empty())
+    {
+        operation = rest.substr(0, rest.find(';'));
+        rest.remove_prefix(std::min(operation.size() + 1, rest.size()));
+        opcode = next_token(operation);
+        if (opcode == "bm" || opcode == "am")
         {
-            ptr_a->shape = PAWN;
-            Shape shape_promo = Shape(tag);
-            phase -= SHAPE_PHASE[shape_promo]; // no need to add SHAPE_PHASE[PAWN] that is 0
-            del_psv(player, shape_promo, sq_f);
+            while (!(operand = next_token(operation)).empty())
+                (opcode == "bm" ? entry.best_moves : entry.avoid_moves).emplace_back(operand);
         }
-        else
-            del_psv(player, shape, sq_f);
+        else if (opcode == "id")
+        {
+            operation.remove_prefix(std::min(operation.find_first_not_of(" \""), operation.size()));
+            entry.id = std::string(operation.substr(0, operation.find('"')));
+        }
+    }
+    return !entry.best_moves.empty() || !entry.avoid_moves.empty();
+}
 
-        // uncastle
-        if (tag == IS_CASTLE)
+/**
+ * "epd path [movetime ms] [depth n] [nodes n] [threads n] [hash MB]": search every position of an EPD test suite and report which were solved.
+ * Positions are handed out to threads (default: all cores), each owning an Engine whose transposition table is cleared before every position.
+ * See WorkerOptions for the limits.
+ */
+void epd(const std::string &cmd)
+{
+    const WorkerOptions options(cmd);
+    std::string_view rest = cmd;
+    next_token(rest); // "epd"
+    std::string path = std::string(next_token(rest));
+
+    std::vector<EPDEntry> entries;
+    std::ifstream in(path);
+    if (!in)
+    {
+        LOG(LOG_ERROR, "could not open " << path);
+        logger.flush();
+        return;
+    }
+    std::string line = "";
+    while (std::getline(in, line))
+    {
+        EPDEntry entry;
+        if (parse_EPD(line, entry))
+            entries.push_back(std::move(entry));
+        else if (line.find_first_not_of(" \t\r") != std::string::npos)
+            LOG(LOG_WARN, "skipped EPD line " << line);
+    }
+
+    std::atomic<size_t> next_i{0}, done_cnt{0};
+    auto work = [&]()
+    {
+        std::unique_ptr<Engine> worker = std::make_unique<Engine>(options.ttable_sz);
+        std::vector<Moves> legal, best_moves, avoid_moves;
+        bool has_best_moves = false; // false if the position only has am operations
+        Moves m;
+        auto is_correct = [&](const Moves &candidate)
         {
-            short rook_sq_i = NULL, rook_sq_f = NULL;
-            if (sq_f < sq_i) // queenside
-            {
-                rook_sq_i = R_SQ_CASTLE[player][Q_SIDE];
-                rook_sq_f = sq_f + 1;
-            }
-            else // kingside
+            auto is_same = [&](const Moves &other)
             {
-                rook_sq_i = R_SQ_CASTLE[player][K_SIDE];
-                rook_sq_f = sq_f - 1;
-            }
-            Piece *rook_ptr = squares[rook_sq_f];
-            rook_ptr->sq = rook_sq_i;
-            squares[rook_sq_i] = rook_ptr;
-            squares[rook_sq_f] = nullptr;
+                return other.sq_i == candidate.sq_i && other.sq_f == candidate.sq_f && other.tag == candidate.tag;
+            };
+            return (!has_best_moves || std::any_of(best_moves.begin(), best_moves.end(), is_same)) &&
+                   std::none_of(avoid_moves.begin(), avoid_moves.end(), is_same);
+        };
 
-            add_psv(player, ROOK, rook_sq_i);
-            del_psv(player, ROOK, rook_sq_f);
+        Tag tag = IS_NORM;
+        short sq_i = -1, sq_f = -1;
+        for (size_t i = next_i++; i < entries.size(); i = next_i++)
+        {
+            EPDEntry &entry = entries[i];
+            worker->clear();
+            worker->load(entry.FEN);
+            std::fill(worker->ttable.begin(), worker->ttable.end(), TtableEntry());
+
+            has_best_moves = !entry.best_moves.empty();
+            best_moves.clear();
+            avoid_moves.clear();
+            for (const std::string &SAN : entry.best_moves)
+                if (worker->parse_SAN(SAN, m))
+                    best_moves.push_back(m);
+            for (const std::string &SAN : entry.avoid_moves)
+                if (worker->parse_SAN(SAN, m))
+                    avoid_moves.push_back(m);
+            if (best_moves.size() < entry.best_moves.size() || avoid_moves.size() < entry.avoid_moves.size())
+                LOG(LOG_WARN, "illegal or unsupported move in EPD " << entry.id << ' ' << entry.FEN);
+
+            worker->on_iteration = [&](const RootMove &best, long long ms)
+            {
+                if (!is_correct(best.move))
+                    entry.solved_ms = -1;
+                else if (entry.solved_ms < 0)
+                    entry.solved_ms = ms;
+            };
+            worker->limits = options.limits;
+            worker->params = options.params;
+            worker->stop = false;
+            sq_i = -1;
+            worker->root_eval(tag, sq_i, sq_f);
+            entry.nodes = worker->nodes;
+
+            legal = worker->legal_moves();
+            for (const Moves &found : legal)
+                if (found.sq_i == sq_i && found.sq_f == sq_f)
+                {
+                    entry.found = worker->SAN_of(found, legal);
+                    entry.is_solved = is_correct(found);
+                }
+            if (!entry.is_solved)
+                entry.solved_ms = -1;
+
+            std::lock_guard<std::mutex> lock(io_mutex);
+            std::cout << ++done_cnt << '/' << entries.size() << ' ' << (entry.id.empty() ? entry.FEN : entry.id)
+                << (entry.is_solved ? " solved " : " failed ") << entry.found;
+            for (size_t j = 0; j < entry.best_moves.size(); j++)
+                std::cout << (j ? " " : " bm ") << entry.best_moves[j];
+            for (size_t j = 0; j < entry.avoid_moves.size(); j++)
+                std::cout << (j ? " " : " am ") << entry.avoid_moves[j];
+            if (entry.is_solved)
+                std::cout << " time " << entry.solved_ms;
+            std::cout << " nodes " << entry.nodes << '\n' << std::flush;
         }
+    };
 
-        // uncapture
-        if (ptr_v)
-        {
-            ptr_v->respawn();
+    long long start = now_ms();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::min(options.thread_cnt, entries.size()); i++)
+        threads.emplace_back(work);
+    for (std::thread &thread : threads)
+        thread.join();
+    long long time = std::max(now_ms() - start, 1LL);
+    if (tracer.is_enabled)
+        tracer.dump();
+
+    long long solved_cnt = 0, solved_ms = 0;
+    unsigned long long nodes = 0;
+    for (const EPDEntry &entry : entries)
+    {
+        solved_cnt += entry.is_solved;
+        solved_ms += entry.is_solved ? entry.solved_ms : 0;
+        nodes += entry.nodes;
+    }
 
-            Shape shape_v = ptr_v->shape;
-            phase += SHAPE_PHASE[shape_v];
-            add_psv(!player, shape_v, sq_f);
-        }
+    std::lock_guard<std::mutex> lock(io_mutex);
+    std::cout << '\n'
+        << "Solved          : " << solved_cnt << " / " << entries.size() << '\n'
+        << "Mean solve (ms) : " << (solved_cnt ? solved_ms / solved_cnt : 0) << '\n'
+        << "Total time (ms) : " << time << '\n'
+        << "Nodes searched  : " << nodes << '\n'
+        << "Nodes/second    : " << nodes * 1000 / time << '\n'
+        << std::flush;
+    logger.flush();
+}
 
-        ptr_a->sq = sq_i;
-        squares[sq_i] = ptr_a;
-        squares[sq_f] = ptr_v;
-        add_psv(player, shape, sq_i);
+const size_t BATCH_WINDOW_PER_THREAD = 64; // positions read ahead of the oldest unwritten result, per worker
+
+/**
+ * @return raw JSON value of key in the JSON object line, e.g. "\"abc\"" or "12", empty if not found. Nested objects are not supported.
+ */
+std::string_view JSON_value_of(std::string_view line, std::string_view key)
+{
+    size_t at = 0;
+    while ((at = line.find(key, at + 1)) != std::string_view::npos && at < line.size())
+    {
+        if (line[at - 1] != '"' || at + key.size() >= line.size() || line[at + key.size()] != '"')
+            continue;
+        std::string_view value = line.substr(at + key.size() + 1);
+        value.remove_prefix(std::min(value.find_first_not_of(" \t:"), value.size()));
+        size_t end = 0;
+        if (!value.empty() && value[0] == '"')
+            for (end = 1; end < value.size() && value[end] != '"'; end++)
+                end += (value[end] == '\\');
+        else
+            end = std::min(value.find_first_of(",}"), value.size()) - 1;
+        value = value.substr(0, end + 1);
+        while (!value.empty() && isspace(value.back()))
+            value.remove_suffix(1);
+        return value;
     }
+    return "";
+}
 
-    /**
-     * @return whether all squares on the path (excluding sq_f) are empty.
-     * IMPORTANT: d_cheb must be positive!
-     */
-    inline bool is_path_clear(short sq_i, short sq_f, unsigned short d_cheby) const
+/**
+ * @return str as a JSON string literal.
+ */
+std::string JSON_string_of(std::string_view str)
+{
+    std::string JSON = "\"";
+    for (char ch : str)
     {
-        short v = (sq_f - sq_i) / d_cheby;
-        for (short sq = sq_i + v; sq != sq_f; sq += v)
+        if (ch == '"' || ch == '\\')
+            JSON += '\\';
+        if (0 <= ch && ch < ' ')
+            JSON += ' ';
+        else
+            JSON += ch;
+    }
+    return JSON + '"';
+}
+
+/**
+ * A position of batch, from being read until its result is written.
+ */
+struct BatchJob
+{
+    std::string id = "", FEN = ""; // id is a JSON value
+    std::string result = ""; // JSON line
+    bool is_done = false;
+};
+
+/**
+ * Command line mode "batch [file path] [unordered] [movetime ms] [depth n] [nodes n] [threads n] [hash MB]":
+ * analyze a stream of positions from path (default: stdin) on a pool of workers and write one JSON line per position to stdout, e.g.
+ * {"id": 1, "fen": "...", "bestmove": "e2e4", "cp": 35, "depth": 7, "seldepth": 11, "nodes": 151226, "time": 212, "pv": "e2e4 e7e5"}
+ * A score is either "cp" (centipawns) or "mate" (moves), from the side to move. Invalid positions give {"id": ..., "error": "..."}.
+ *
+ * Input lines are FENs, whose id is the line number, or JSON objects with "fen" and an optional "id" (a string or a number).
+ * Results are written in input order, or as they finish with unordered. Either way at most BATCH_WINDOW_PER_THREAD positions
+ * per worker are held in memory: reading waits while the window is full, so input of any size streams through.
+ * Every worker owns an Engine whose transposition table is cleared before every position, so results do not depend on scheduling.
+ * See WorkerOptions for the limits.
+ */
+void batch(const std::string &cmd)
+{
+    const WorkerOptions options(cmd);
+    const bool is_ordered = cmd.find(" unordered") == std::string::npos;
+    std::ifstream file;
+    size_t path_at = cmd.find(" file ");
+    if (path_at != std::string::npos)
+    {
+        std::string_view rest = std::string_view(cmd).substr(path_at + 6);
+        std::string path = std::string(next_token(rest));
+        file.open(path);
+        if (!file)
         {
-            if (squares[sq])
-                return false;
+            LOG(LOG_ERROR, "could not open " << path);
+            logger.flush();
+            return;
         }
-        return true;
     }
+    std::istream &in = file.is_open() ? file : std::cin;
 
-    /**
-     * @return whether the given square is currently attacked by the enemy of the given player.
-     */
-    inline bool is_check(Player player)
+    // jobs[seq % window] holds position seq from being read until it is taken by a worker (unordered) or its result is written (ordered)
+    const size_t window = options.thread_cnt * BATCH_WINDOW_PER_THREAD;
+    std::vector<BatchJob> jobs(window);
+    size_t read_seq = 0, take_seq = 0, write_seq = 0, done_cnt = 0;
+    bool is_eof = false;
+    std::mutex mutex;
+    std::condition_variable can_read, can_take;
+
+    auto write = [&](const std::string &result) // caller holds mutex
     {
-        // check for enemy pawns by posing as pawn and check where I can capture
-        short dx = NULL,sq_a = NULL, sq_k = KING_PTR[player]->sq;
+        std::lock_guard<std::mutex> lock(io_mutex);
+        std::cout << result << '\n';
+    };
+
+    auto work = [&]()
+    {
+        std::unique_ptr<Engine> worker = std::make_unique<Engine>(options.ttable_sz);
+        RootMove best;
+        short depth = 0;
+        worker->on_iteration = [&](const RootMove &best_, long long)
         {
-            short sq_y = sq_k + rel_forward(player);
-            for (dx = -1; dx <= 1; dx += 2)
+            best = best_;
+            depth = worker->max_depth;
+        };
+        std::string id = "", FEN = "", result = "";
+        std::ostringstream out;
+        Tag tag = IS_NORM;
+        short sq_i = -1, sq_f = -1;
+        while (true)
+        {
+            size_t seq = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                can_take.wait(lock, [&]() { return take_seq < read_seq || is_eof; });
+                if (take_seq == read_seq)
+                    return;
+                seq = take_seq++;
+                id = jobs[seq % window].id;
+                FEN = jobs[seq % window].FEN;
+            }
+
+            out.str("");
+            out << "{\"id\": " << id << ", \"fen\": " << JSON_string_of(FEN);
+            worker->clear();
+            if (!worker->load(FEN))
+                out << ", \"error\": \"invalid FEN\"}";
+            else
             {
-                sq_a = sq_y + dx;
-                if (is_play_area(sq_a) && squares[sq_a])
+                std::fill(worker->ttable.begin(), worker->ttable.end(), TtableEntry());
+                worker->limits = options.limits;
+                worker->params = options.params;
+                worker->stop = false;
+                best = RootMove();
+                depth = 0;
+                sq_i = -1;
+                long long start = now_ms();
+                worker->root_eval(tag, sq_i, sq_f);
+
+                std::string score = (sq_i < 0) ? (worker->is_check(worker->glob_player) ? "mate 0" : "cp 0") : UCI_score_of(best.score, worker->glob_player);
+                out << ", \"bestmove\": \"" << (sq_i < 0 ? "0000" : LAN_of(tag, sq_i, sq_f)) << '"'
+                    << ", \"" << score.substr(0, score.find(' ')) << "\": " << score.substr(score.find(' ') + 1)
+                    << ", \"depth\": " << depth << ", \"seldepth\": " << worker->sel_depth
+                    << ", \"nodes\": " << worker->nodes << ", \"time\": " << now_ms() - start << ", \"pv\": \"";
+                for (short i = 0; i < best.line_len; i++)
+                    out << (i ? " " : "") << LAN_of(best.line[i].tag, best.line[i].sq_i, best.line[i].sq_f);
+                out << "\"}";
+            }
+            result = out.str();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            done_cnt++;
+            if (!is_ordered)
+                write(result);
+            else
+            {
+                jobs[seq % window].result = std::move(result);
+                jobs[seq % window].is_done = true;
+                for (BatchJob *job = &jobs[write_seq % window]; write_seq < read_seq && job->is_done; job = &jobs[++write_seq % window])
                 {
-                    Piece *attacker = squares[sq_a];
-                    if (attacker->player != player && attacker->shape == PAWN)
-                        return true;
+                    write(job->result);
+                    job->is_done = false;
                 }
             }
+            can_read.notify_one();
         }
+    };
 
-        // check for enemy KNIGHT, BISHOP, ROOK, QUEEN, KING by iterating over each piece
-        short dy = NULL, d_cheby = NULL;
-        Shape shape_a;
-        for (Piece *attacker = pieces[!player]; attacker <= KING_PTR[!player]; attacker++)
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < options.thread_cnt; i++)
+        threads.emplace_back(work);
+
+    std::string line = "";
+    std::string_view FEN, id;
+    long long start = now_ms();
+    for (size_t line_cnt = 1; std::getline(in, line); line_cnt++)
+    {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line[line.find_first_not_of(" \t")] == '{')
         {
-            if (attacker->is_alive())
-            {
-                shape_a = attacker->shape;
-                if (shape_a != PAWN)
-                {
-                    sq_a = attacker->sq;
-                    dx = abs(x_of(sq_a) - x_of(sq_k));
-                    dy = abs(y_of(sq_a) - y_of(sq_k));
-                    d_cheby = std::max(dx, dy);
+            FEN = JSON_value_of(line, "fen");
+            if (FEN.size() >= 2 && FEN[0] == '"')
+                FEN = FEN.substr(1, FEN.size() - 2);
+            id = JSON_value_of(line, "id");
+        }
+        else
+        {
+            FEN = line;
+            id = "";
+        }
 
-                    if (shape_a == KNIGHT && ((dx == 1 && dy == 2) || (dx == 2 && dy == 1)))
-                        return true;
+        std::unique_lock<std::mutex> lock(mutex);
+        can_read.wait(lock, [&]() { return read_seq - (is_ordered ? write_seq : done_cnt) < window; });
+        BatchJob &job = jobs[read_seq++ % window];
+        job.id = id.empty() ? std::to_string(line_cnt) : std::string(id);
+        job.FEN = std::string(FEN);
+        can_take.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_eof = true;
+    }
+    can_take.notify_all();
+    for (std::thread &thread : threads)
+        thread.join();
 
-                    else if (shape_a == BISHOP && dx == dy && is_path_clear(sq_k, sq_a, d_cheby))
-                        return true;
+    LOG(LOG_INFO, "batch: " << done_cnt << " positions in " << now_ms() - start << " ms");
+    std::cout << std::flush;
+    logger.flush();
+}
 
-                    else if (shape_a == ROOK && (dx == 0 || dy == 0) && is_path_clear(sq_k, sq_a, d_cheby))
-                        return true;
+const long long MATCH_GAMES = 100;
+const short MATCH_MAX_PLY = 400; // a game still running after this many plies is a draw
 
-                    else if (shape_a == QUEEN && (dx == dy || dx == 0 || dy == 0) && is_path_clear(sq_k, sq_a, d_cheby))
-                        return true;
+/**
+ * @return Elo difference of a score fraction (0 < score < 1).
+ */
+inline double elo_of(double score)
+{
+    return -400 * std::log10(1 / score - 1);
+}
 
-                    else if (shape_a == KING && d_cheby <= 1)
-                        return true;
-                }
-            }
-        }
-        return false;
-    }
+/**
+ * @return score fraction expected at an Elo difference.
+ */
+inline double score_of(double elo)
+{
+    return 1 / (1 + std::pow(10, -elo / 400));
+}
 
-    inline short static_eval()
-    {
-        short net_psv_opening = psv_opening[MAXER] - psv_opening[MINER],
-              net_psv_endgame = psv_endgame[MAXER] - psv_endgame[MINER];
+/**
+ * Sequential Probability Ratio Test of H1: Elo difference is elo1 against H0: it is elo0,
+ * with the normal approximation of the log-likelihood ratio of win/draw/loss results.
+ * @return log-likelihood ratio, H1 is accepted once it is above log((1 - beta) / alpha) and H0 once below log(beta / (1 - alpha)).
+ */
+double LLR_of(long long wins, long long draws, long long losses, double elo0, double elo1)
+{
+    long long n = wins + draws + losses;
+    if (!n)
+        return 0;
+    double score = (wins + draws / 2.0) / n,
+           var = (wins * std::pow(1 - score, 2) + draws * std::pow(0.5 - score, 2) + losses * std::pow(score, 2)) / n,
+           score0 = score_of(elo0), score1 = score_of(elo1);
+    if (var <= 0) // all results are equal so far
+        return 0;
+    return (score1 - score0) * (2 * score - score0 - score1) * n / (2 * var);
+}
 
-        return net_psv_endgame - (net_psv_endgame - net_psv_opening)*std::min(phase, MAX_PHASE)/MAX_PHASE; // linear interpolation
+/**
+ * @return FENs of the file after "openings" in cmd, 1 FEN or EPD per line, BENCH_FENS if none.
+ */
+std::vector<std::string> read_openings(const std::string &cmd)
+{
+    std::vector<std::string> openings;
+    size_t path_at = cmd.find(" openings ");
+    if (path_at != std::string::npos)
+    {
+        std::string_view rest = std::string_view(cmd).substr(path_at + 10);
+        std::string path = std::string(next_token(rest)), line = "";
+        std::ifstream in(path);
+        if (!in)
+            LOG(LOG_ERROR, "could not open " << path);
+        while (std::getline(in, line))
+        {
+            rest = line;
+            std::string FEN = "";
+            for (short i = 0; i < 4; i++)
+                FEN += std::string(next_token(rest)) + (i < 3 ? " " : " 0 1");
+            if (is_loadable_FEN(FEN))
+                openings.push_back(FEN);
+        }
     }
+    if (openings.empty())
+        openings.assign(std::begin(BENCH_FENS), std::end(BENCH_FENS));
+    return openings;
+}
 
-    inline bool is_repeat(const unsigned long long hash, short depth)
+/**
+ * Play a game from FEN between engines[0] and engines[1], each searching with its own limits and params, after clearing their transposition tables.
+ * Both engines play every move, so either holds the game. It ends by mate_type(), Engine::is_draw() or MATCH_MAX_PLY.
+ * @return score of white: 1, 0.5 or 0, and how the game ended in reason.
+ */
+double play_game(Engine *const engines[2], const std::string &FEN, bool is_0_white, std::string &reason)
+{
+    for (short side = 0; side < 2; side++)
     {
-        return depth >= 3 && hash == ancestors[depth-3]; // experimentally determined no need to check lower/higher depths
+        engines[side]->clear();
+        engines[side]->load(FEN);
+        std::fill(engines[side]->ttable.begin(), engines[side]->ttable.end(), TtableEntry());
+        engines[side]->on_iteration = [](const RootMove &, long long) {};
     }
 
-    inline void into_ttable(const unsigned long long hash, short score, short total_depth)
+    Engine &board = *engines[0];
+    Tag tag = IS_NORM;
+    short sq_i = -1, sq_f = -1;
+    for (short ply = 0; ; ply++)
     {
-        TtableEntry &entry = ttable[hash % TABLE_SZ];
-        if (total_depth >= entry.total_depth) // if bucket collision, keep the more recent and deeper search
+        std::string mate = board.mate_type();
+        if (mate != "")
         {
-            entry.hash = hash;
-            entry.score = score;
-            entry.total_depth = total_depth;
+            reason = (mate == "Stalemate!") ? "stalemate" : "mate";
+            return (mate == "You win!") ? 1 : (mate == "You lost!") ? 0 : 0.5; // "You win!": black is checkmated
+        }
+        if (board.is_draw() || ply >= MATCH_MAX_PLY)
+        {
+            reason = (ply >= MATCH_MAX_PLY) ? "max plies" : "draw";
+            return 0.5;
         }
+
+        Engine &mover = *engines[((board.glob_player == HUMAN) == is_0_white) ? 0 : 1];
+        mover.stop = false;
+        sq_i = -1;
+        mover.root_eval(tag, sq_i, sq_f);
+        if (sq_i < 0) // no legal move found by the search
+        {
+            reason = board.is_check(board.glob_player) ? "mate" : "stalemate";
+            return (reason == "stalemate") ? 0.5 : (board.glob_player == BOT) ? 1 : 0;
+        }
+        for (short side = 0; side < 2; side++)
+            engines[side]->play(tag, sq_i, sq_f);
     }
+}
 
-    inline short lose_score_score(Player player, short depth)
+/**
+ * Command line mode "match [games n] [openings path] [threads n] [sprt elo0 elo1] [alpha a] [beta b] [a options] [b options]":
+ * play games between engines A and B, each configured by WorkerOptions (e.g. "a depth 6 b depth 5", "a nodes 20000 hash 64"), on a pool of threads.
+ * Every game is played in-process by 2 Engines, each with its own transposition table cleared before the game.
+ *
+ * Games are played in pairs from the same opening with colors swapped, see read_openings() and play_game(). Every result prints a line with W/D/L of A, Elo of A - B with its 95% interval,
+ * and the log-likelihood ratio of the SPRT (default: elo0 0, elo1 5, alpha = beta = 0.05). No more games are started once the SPRT accepts a hypothesis.
+ */
+void match(const std::string &cmd)
+{
+    size_t a_at = cmd.find(" a "), b_at = cmd.find(" b ");
+    std::string common = cmd.substr(0, std::min(a_at, b_at)),
+                options_A = (a_at == std::string::npos) ? "" : cmd.substr(a_at + 2, (b_at > a_at) ? b_at - a_at - 2 : std::string::npos),
+                options_B = (b_at == std::string::npos) ? "" : cmd.substr(b_at + 2, (a_at > b_at) ? a_at - b_at - 2 : std::string::npos);
+    const WorkerOptions options(common), configs[2] = {WorkerOptions("a" + options_A), WorkerOptions("b" + options_B)};
+
+    long long game_cnt = MATCH_GAMES;
+    double elo0 = 0, elo1 = 5, alpha = 0.05, beta = 0.05;
+    std::vector<std::string> openings = read_openings(common);
+    std::istringstream tokens(common);
+    std::string token = "";
+    while (tokens >> token)
     {
-        return (player == MAXER) ? SHRT_MIN + depth : SHRT_MAX - depth; // earlier checkmate preferred over later
+        if (token == "games")
+            tokens >> game_cnt;
+        else if (token == "sprt")
+            tokens >> elo0 >> elo1;
+        else if (token == "alpha")
+            tokens >> alpha;
+        else if (token == "beta")
+            tokens >> beta;
     }
+    if (size_t(game_cnt) > 2 * openings.size())
+        LOG(LOG_WARN, game_cnt << " games from " << openings.size() << " openings: searches limited by depth or nodes replay the same game pairs");
+    const double lower = std::log(beta / (1 - alpha)), upper = std::log((1 - beta) / alpha);
 
-    inline bool will_check(Player player, short sq_i, short sq_f, Piece *ptr_v)
+    std::mutex mutex;
+    long long wins = 0, draws = 0, losses = 0; // of A
+    std::atomic<long long> next_game{0};
+    std::atomic<bool> is_decided{false};
+
+    auto work = [&]()
     {
-        if (ptr_v)
-            ptr_v->kill();
-        Piece *ptr_a = squares[sq_i];
-        ptr_a->sq = sq_f;
-        squares[sq_f] = ptr_a;
-        squares[sq_i] = nullptr;
+        std::unique_ptr<Engine> engines[2];
+        for (short side = 0; side < 2; side++)
+        {
+            engines[side] = std::make_unique<Engine>(configs[side].ttable_sz);
+            engines[side]->limits = configs[side].limits;
+            engines[side]->params = configs[side].params;
+        }
+        Engine *const players[2] = {engines[0].get(), engines[1].get()};
+        std::string reason = "";
+        for (long long game = next_game++; game < game_cnt && !is_decided; game = next_game++)
+        {
+            bool is_A_white = !(game & 1);
+            double white_score = play_game(players, openings[(game / 2) % openings.size()], is_A_white, reason),
+                   score = is_A_white ? white_score : 1 - white_score;
+            std::lock_guard<std::mutex> lock(mutex);
+            wins += (score == 1);
+            draws += (score == 0.5);
+            losses += (score == 0);
+            long long n = wins + draws + losses;
+            double mean = (wins + draws / 2.0) / n,
+                   margin = 1.96 * std::sqrt((wins * std::pow(1 - mean, 2) + draws * std::pow(0.5 - mean, 2) + losses * std::pow(mean, 2)) / n / n),
+                   LLR = LLR_of(wins, draws, losses, elo0, elo1);
+            auto clamped_elo_of = [](double score)
+            {
+                return elo_of(std::max(0.001, std::min(score, 0.999)));
+            };
+            if (LLR <= lower || LLR >= upper)
+                is_decided = true;
+
+            std::lock_guard<std::mutex> io_lock(io_mutex);
+            std::cout << "Game " << game + 1 << " (A " << (is_A_white ? "white" : "black") << "): "
+                << (white_score == 1 ? "1-0" : white_score == 0 ? "0-1" : "1/2-1/2") << ' ' << reason
+                << ", A +" << wins << " =" << draws << " -" << losses << std::fixed << std::setprecision(1)
+                << ", Elo " << clamped_elo_of(mean) << " [" << clamped_elo_of(mean - margin) << ", " << clamped_elo_of(mean + margin) << ']'
+                << std::setprecision(2) << ", LLR " << LLR << " [" << lower << ", " << upper << "]\n" << std::flush;
+            std::cout.unsetf(std::ios::fixed);
+        }
+    };
 
-        bool will_check = is_check(player);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::min(options.thread_cnt, size_t(game_cnt)); i++)
+        threads.emplace_back(work);
+    for (std::thread &thread : threads)
+        thread.join();
+
+    double LLR = LLR_of(wins, draws, losses, elo0, elo1);
+    std::lock_guard<std::mutex> lock(io_mutex);
+    std::cout << '\n' << "SPRT elo0 " << elo0 << " elo1 " << elo1 << ": "
+        << (LLR >= upper ? "H1 accepted" : LLR <= lower ? "H0 accepted" : "inconclusive") << '\n' << std::flush;
+    logger.flush();
+}
 
-        if (ptr_v)
-            ptr_v->respawn();
-        ptr_a->sq = sq_i;
-        squares[sq_i] = ptr_a;
-        squares[sq_f] = ptr_v;
-        if (will_check)
-            illegal++;
-        else
-            legal++;
-        return will_check;
+const long long SPSA_ITERATIONS = 10000; // game pairs
+const unsigned long long SPSA_NODES = 5000; // per move if spsa is given no limit
+const long long SPSA_CHECKPOINT_INTERVAL = 100; // iterations between checkpoints
+const double SPSA_RATE = 0.005, // learning rate at the end of tuning
+             SPSA_ALPHA = 0.602, SPSA_GAMMA = 0.101; // decay of the learning rate and of the perturbation
+
+/**
+ * Command line mode "spsa [iterations n] [openings path] [checkpoint path] [rate r] [threads n] [options]": tune PARAMS by
+ * Simultaneous Perturbation Stochastic Approximation. Every iteration k perturbs all parameters at once by +/- c_k (random signs),
+ * plays a game pair (see play_game()) between the 2 perturbed engines with the options of WorkerOptions (default: SPSA_NODES per move),
+ * and moves the parameters towards the winner by r_k * c_k per game won. c_k decays to Param::step and r_k to rate at the last iteration.
+ *
+ * Iterations run concurrently, one game pair per thread, each perturbing the latest parameters.
+ * Every SPSA_CHECKPOINT_INTERVAL iterations the parameters are printed and written to the checkpoint file (default: spsa.txt),
+ * from which a later run with the same checkpoint resumes.
+ */
+void spsa(const std::string &cmd)
+{
+    const WorkerOptions options(cmd, SPSA_NODES);
+    const std::vector<std::string> openings = read_openings(cmd);
+    long long iteration_cnt = SPSA_ITERATIONS;
+    double rate = SPSA_RATE;
+    std::string checkpoint = "spsa.txt", token = "";
+    std::istringstream tokens(cmd);
+    while (tokens >> token)
+    {
+        if (token == "iterations")
+            tokens >> iteration_cnt;
+        else if (token == "checkpoint")
+            tokens >> checkpoint;
+        else if (token == "rate")
+            tokens >> rate;
     }
 
-    inline bool is_legal_castle(bool is_check_i, Player player, short sq_i, short sq_f)
+    const size_t param_cnt = std::size(PARAMS);
+    std::vector<double> theta(param_cnt);
+    for (size_t i = 0; i < param_cnt; i++)
+        theta[i] = PARAMS[i].default_value;
+    long long done_cnt = 0;
+    std::ifstream in(checkpoint);
+    if (in)
     {
-        return !is_check_i && !will_check(player, sq_i, sq_i + (sq_f < sq_i ? -1 : 1), nullptr);
+        std::string name = "";
+        double value = 0;
+        in >> token >> done_cnt; // "iteration n"
+        while (in >> name >> value)
+            for (size_t i = 0; i < param_cnt; i++)
+                if (name == PARAMS[i].name)
+                    theta[i] = value;
+        LOG(LOG_INFO, "resumed " << checkpoint << " at iteration " << done_cnt);
     }
+    in.close();
+
+    const double A = 0.1 * iteration_cnt;
+    std::mutex mutex;
+    std::atomic<long long> next_k{done_cnt + 1};
 
-    short QS_eval(const unsigned long long hash, Player player, short alpha, short beta)
+    auto print = [&](std::ostream &out) // caller holds mutex
     {
-        short score = static_eval();
+        for (size_t i = 0; i < param_cnt; i++)
+            out << PARAMS[i].name << ' ' << theta[i] << '\n';
+    };
 
-        // stand pat
-        if (!is_check(player))
+    auto work = [&]()
+    {
+        std::unique_ptr<Engine> engines[2] = {std::make_unique<Engine>(options.ttable_sz), std::make_unique<Engine>(options.ttable_sz)};
+        Engine *const players[2] = {engines[0].get(), engines[1].get()};
+        for (std::unique_ptr<Engine> &engine : engines)
+            engine->limits = options.limits;
+        std::vector<double> c_k(param_cnt);
+        std::vector<short> signs(param_cnt);
+        std::string reason = "";
+        for (long long k = next_k++; k <= iteration_cnt; k = next_k++)
         {
-            if (player == MAXER)
+            std::mt19937 sign_gen{unsigned(k)}; // same perturbation signs for the same iteration
             {
-                if (score >= beta)
-                    return score;
-
-                if (score > alpha)
-                    alpha = score;
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t i = 0; i < param_cnt; i++)
+                {
+                    const Param &param = PARAMS[i];
+                    c_k[i] = param.step * std::pow(double(iteration_cnt) / k, SPSA_GAMMA);
+                    signs[i] = (sign_gen() & 1) ? 1 : -1;
+                    for (short side = 0; side < 2; side++)
+                    {
+                        short value = short(std::lround(theta[i] + (side ? -1 : 1) * signs[i] * c_k[i]));
+                        engines[side]->params.*param.value = std::max(param.min, std::min(value, param.max));
+                    }
+                }
             }
-            else
+
+            // result of engines[0] (theta + c_k), from -2 to 2
+            const std::string &FEN = openings[k % openings.size()];
+            double result = 2 * play_game(players, FEN, true, reason) - 1;
+            result += 1 - 2 * play_game(players, FEN, false, reason);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            double a_k = rate * std::pow(A + iteration_cnt, SPSA_ALPHA) / std::pow(A + k, SPSA_ALPHA);
+            for (size_t i = 0; i < param_cnt; i++)
             {
-                if (score <= alpha)
-                    return score;
+                const Param &param = PARAMS[i];
+                double c_end = param.step, r_k = a_k * c_end * c_end / (c_k[i] * c_k[i]); // learning rate, rate at the last iteration
+                theta[i] = std::max(double(param.min), std::min(theta[i] + r_k * c_k[i] * result * signs[i], double(param.max)));
+            }
 
-                if (score < beta)
-                    beta = score;
+            if (++done_cnt % SPSA_CHECKPOINT_INTERVAL == 0 || done_cnt == iteration_cnt)
+            {
+                std::ofstream out(checkpoint + ".tmp");
+                out << "iteration " << done_cnt << '\n';
+                print(out);
+                out.close();
+                std::rename((checkpoint + ".tmp").c_str(), checkpoint.c_str());
+
+                std::lock_guard<std::mutex> io_lock(io_mutex);
+                std::cout << "Iteration " << done_cnt << '/' << iteration_cnt << '\n';
+                print(std::cout);
+                std::cout << std::flush;
             }
         }
+    };
 
-        short child_score = NULL;
-        unsigned long long child_hash = NULL;
-        TtableEntry *child_ttable;
-        Moves *m = nullptr;
-        MVVLVAMoveGenerator moves(*this, player, true, nullptr);
-        while ((m = moves.next()))
-        {
-            if (will_check(player, m->sq_i, m->sq_f, m->ptr_v))
-                continue;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < options.thread_cnt; i++)
+        threads.emplace_back(work);
+    for (std::thread &thread : threads)
+        thread.join();
+
+    std::lock_guard<std::mutex> lock(io_mutex);
+    std::cout << '\n' << "Tuned (rounded):" << '\n';
+    for (size_t i = 0; i < param_cnt; i++)
+        std::cout << "setoption name " << PARAMS[i].name << " value " << std::lround(theta[i]) << '\n';
+    std::cout << std::flush;
+    logger.flush();
+}
 
-            child_hash = move(hash, player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v, nullptr);
+const long long DATAGEN_POSITIONS = 1000000;
+const unsigned long long DATAGEN_NODES = 5000; // per move if datagen is given no limit
+const short DATAGEN_RANDOM_PLIES = 8, // random legal moves played from the opening before the engine plays
+            DATAGEN_WIN_SCORE = 1500, // a game is adjudicated once both sides' searches score beyond this...
+            DATAGEN_WIN_PLIES = 4; // ...for this many plies in a row
+const long long DATAGEN_REPORT_INTERVAL = 100; // games between progress lines
 
-            child_ttable = &ttable[child_hash % TABLE_SZ];
-            if (child_ttable->hash == child_hash)
-                child_score = child_ttable->score;
+/**
+ * A position of the training data written by datagen, from a file starting with a DataHeader.
+ */
+struct DataRecord
+{
+    PackedBoard board;
+    short score; // of white, by the search of the position
+    unsigned short ply; // plies since the start of the game
+    unsigned char flags; // PACKED_WHITE_TO_MOVE | PACKED_CASTLE[player][side]
+    unsigned char rev_cnt; // plies since the last irreversible move, at most 255
+    signed char result; // of white: 1 win, 0 draw, -1 loss
+    unsigned char reserved;
+};
+static_assert(sizeof(DataRecord) == 32, "DataRecord is a file format");
 
-            else
-                child_score = QS_eval(child_hash, !player, alpha, beta);
+struct DataHeader
+{
+    char magic[8]; // DATA_MAGIC
+    unsigned int record_sz;
+    unsigned int reserved;
+};
+const char DATA_MAGIC[8] = {'S', 'G', '4', 'D', 'A', 'T', 'A', '1'};
 
-            unmove(player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v);
+/**
+ * @return record of the current position of engine, with result 0.
+ */
+DataRecord record_of(const Engine &engine, short score, unsigned short ply)
+{
+    PackedPosition pos = engine.pack();
+    DataRecord record = {};
+    record.board = pos.board;
+    record.score = score;
+    record.ply = ply;
+    record.flags = pos.flags;
+    record.rev_cnt = (unsigned char)std::min(pos.rev_cnt, (unsigned short)UCHAR_MAX);
+    return record;
+}
 
-            if (player == MAXER)
-            {
-                if (child_score > score)
-                    score = child_score;
-                if (child_score > alpha)
-                    alpha = child_score;
-            }
-            else
-            {
-                if (child_score < score)
-                    score = child_score;
-                if (child_score < beta)
-                    beta = child_score;
-            }
-            if (alpha >= beta)
-            {
-                into_ttable(hash, score, SHRT_MIN); // store depth as -inf to never overwrite proper search
-                return score;
-            }
-        }
-        return score;
+/**
+ * @return position of record, with its move counters.
+ */
+PackedPosition position_of(const DataRecord &record)
+{
+    PackedPosition pos = PackedPosition();
+    pos.board = record.board;
+    pos.flags = record.flags;
+    pos.ep_x = -1;
+    pos.rev_cnt = record.rev_cnt;
+    pos.fullmove = (unsigned short)(record.ply / 2 + 1);
+    return pos;
+}
+
+/**
+ * @return FEN of record, with its move counters.
+ */
+std::string FEN_of(const DataRecord &record)
+{
+    return FEN_of(position_of(record));
+}
+
+/**
+ * Open path to append DataRecords, writing the DataHeader if the file is new.
+ * @return false if path could not be opened or exists with another format.
+ */
+bool open_data(const std::string &path, std::ofstream &out)
+{
+    DataHeader header = {};
+    std::ifstream in(path, std::ios::binary);
+    bool is_append = bool(in);
+    if (is_append && (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+                      !std::equal(DATA_MAGIC, DATA_MAGIC + 8, header.magic) || header.record_sz != sizeof(DataRecord)))
+    {
+        LOG(LOG_ERROR, path << " exists and is not training data");
+        return false;
+    }
+    in.close();
+    out.open(path, std::ios::binary | std::ios::app);
+    if (!out)
+    {
+        LOG(LOG_ERROR, "could not open " << path);
+        return false;
     }
+    if (!is_append)
+    {
+        std::copy(DATA_MAGIC, DATA_MAGIC + 8, header.magic);
+        header.record_sz = sizeof(DataRecord);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    }
+    return true;
+}
 
-    /**
-     * Minimax + Tapered Piece-Square Table Evaluation + AlphaBeta Pruning + Null-Move Prunning + Zobrist Hashing Transposition Table + MVV-LVA + Repetition Check + Quiescence Search + Standing Pat
-     * In first call, use depth = 1, alpha = SHRT_MIN, beta = SHRT_MAX.
-     * @return
-     * n ∈ (SHRT_MIN, 0) U (0, SHRT_MAX) if over MAX_DEPTH.
-     * n = SHRT_MAX if check/stalemated by MAXER.
-     * n = SHRT_MIN if check/stalemated by MINER.
-     */
-    short eval(unsigned long long hash, Player player, short depth, short alpha, short beta, bool is_NM_eval, bool is_PV_node, CastleRight &castle_rights)
+/**
+ * Command line mode "datagen [positions n] [openings path] [random n] [out path] [threads n] [options]": write training data from self-play.
+ * Every game starts from an opening (see read_openings()) followed by random n (default DATAGEN_RANDOM_PLIES) random legal moves,
+ * seeded by the game number, then one engine per thread plays both sides with the options of WorkerOptions (default: DATAGEN_NODES per move).
+ *
+ * Positions are sampled when the side to move is not in check, the search's move is quiet and its score not decisive,
+ * then written once the game ends with its result as DataRecords to out (default: data.bin), appended if it exists.
+ * A game ends by mate_type(), Engine::is_draw(), MATCH_MAX_PLY, or when both sides score beyond DATAGEN_WIN_SCORE for DATAGEN_WIN_PLIES.
+ * misc/data_reader.cpp prints and converts the records to FEN.
+ */
+void datagen(const std::string &cmd)
+{
+    const WorkerOptions options(cmd, DATAGEN_NODES);
+    const std::vector<std::string> openings = read_openings(cmd);
+    long long position_cnt = DATAGEN_POSITIONS;
+    short random_plies = DATAGEN_RANDOM_PLIES;
+    std::string path = "data.bin", token = "";
+    std::istringstream tokens(cmd);
+    while (tokens >> token)
     {
-        if (depth == MAX_DEPTH)
-            return QS_eval(hash, player, alpha, beta);
+        if (token == "positions")
+            tokens >> position_cnt;
+        else if (token == "random")
+            tokens >> random_plies;
+        else if (token == "out")
+            tokens >> path;
+    }
 
-        ancestors[depth] = hash;
-        bool is_check_i = is_check(player);
-        short child_score = NULL;
+    std::ofstream out;
+    if (!open_data(path, out))
+        return;
 
-        // Null-Move Pruning
-        if (depth <= MAX_NM_DEPTH && phase && !is_NM_eval && !is_PV_node && !is_check_i)
-        {
-            if (player == MAXER)
-            {
-                child_score = eval(hash ^ ZPLAYER, !player, depth + NM_DEPTH_INC, beta-1, beta, true, false, castle_rights);
-                if (child_score >= beta)
-                {
-                    ancestors[depth] = NULL;
-                    return beta;
-                }
-            }
-            else
-            {
-                child_score = eval(hash ^ ZPLAYER, !player, depth + NM_DEPTH_INC, alpha, alpha+1, true, false, castle_rights);
-                if (child_score <= alpha)
-                {
-                    ancestors[depth] = NULL;
-                    return alpha;
-                }
-            }
-        }
+    std::mutex mutex;
+    long long written_cnt = 0, done_cnt = 0; // positions, games
+    std::atomic<long long> next_game{0};
+    const long long start = now_ms();
 
-        bool has_child_score = NULL;
-        short lose_score = lose_score_score(player, depth), score = lose_score, total_depth = NULL;
-        unsigned long long child_hash = NULL;
-        CastleRight child_castle_rights;
-        TtableEntry *child_ttable;
-        Moves *m = nullptr;
-        MVVLVAMoveGenerator moves(*this, player, false, castle_rights.data()[player]);
-        while ((m = moves.next()))
+    auto work = [&]()
+    {
+        std::unique_ptr<Engine> engine = std::make_unique<Engine>(options.ttable_sz);
+        engine->limits = options.limits;
+        engine->params = options.params;
+        RootMove best;
+        engine->on_iteration = [&](const RootMove &best_, long long)
+        {
+            best = best_;
+        };
+        std::vector<DataRecord> records;
+        Tag tag = IS_NORM;
+        short sq_i = -1, sq_f = -1;
+        for (long long game = next_game++; ; game = next_game++)
         {
-            if ( will_check(player, m->sq_i, m->sq_f, m->ptr_v) ||
-                (m->tag == IS_CASTLE && !is_legal_castle(is_check_i, glob_player, m->sq_i, m->sq_f)) )
-                continue;
-
-            has_child_score = false;
-            child_castle_rights = castle_rights;
-            child_hash = move(hash, player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v, child_castle_rights.data());
-
-            child_ttable = &ttable[child_hash % TABLE_SZ];
-            total_depth = root_depth + depth;
-            if (child_ttable->hash == child_hash && child_ttable->total_depth >= total_depth)
             {
-                child_score = child_ttable->score;
-                has_child_score = true;
+                std::lock_guard<std::mutex> lock(mutex);
+                if (written_cnt >= position_cnt)
+                    return;
             }
-            else if (!is_repeat(child_hash, depth))
+            engine->clear();
+            engine->load(openings[game % openings.size()]);
+            std::fill(engine->ttable.begin(), engine->ttable.end(), TtableEntry());
+            records.clear();
+
+            std::mt19937 move_gen{unsigned(game)};
+            unsigned short ply = 0;
+            for (; ply < random_plies; ply++)
             {
-                child_score = eval(child_hash, !player, depth+1, alpha, beta, is_NM_eval, is_PV_node, child_castle_rights);
-                has_child_score = true;
-                is_PV_node = false;
+                std::vector<Moves> legal = engine->legal_moves();
+                if (legal.empty())
+                    break;
+                const Moves &m = legal[move_gen() % legal.size()];
+                engine->play(m.tag, m.sq_i, m.sq_f);
             }
 
-            unmove(player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v);
-
-            if (has_child_score)
+            signed char result = 0;
+            for (short win_cnt[MAX_PLAYER] = {0, 0}; ; ply++)
             {
-                if (player == MAXER)
+                std::string mate = engine->mate_type();
+                if (mate != "")
                 {
-                    if (child_score > score)
-                        score = child_score;
-                    if (child_score > alpha)
-                        alpha = child_score;
+                    result = (mate == "You win!") ? 1 : (mate == "You lost!") ? -1 : 0; // "You win!": black is checkmated
+                    break;
                 }
-                else
+                if (engine->is_draw() || ply >= MATCH_MAX_PLY)
+                    break;
+
+                engine->stop = false;
+                best = RootMove();
+                sq_i = -1;
+                engine->root_eval(tag, sq_i, sq_f);
+                if (sq_i < 0) // no legal move found by the search
                 {
-                    if (child_score < score)
-                        score = child_score;
-                    if (child_score < beta)
-                        beta = child_score;
+                    result = !engine->is_check(engine->glob_player) ? 0 : (engine->glob_player == BOT) ? 1 : -1;
+                    break;
                 }
-                if (alpha >= beta)
+                short score = best.score;
+                win_cnt[HUMAN] = (score >= DATAGEN_WIN_SCORE) ? win_cnt[HUMAN] + 1 : 0;
+                win_cnt[BOT] = (score <= -DATAGEN_WIN_SCORE) ? win_cnt[BOT] + 1 : 0;
+                if (win_cnt[HUMAN] >= DATAGEN_WIN_PLIES || win_cnt[BOT] >= DATAGEN_WIN_PLIES)
                 {
-                    into_ttable(hash, score, total_depth);
-                    ancestors[depth] = NULL;
-                    return score;
+                    result = (score > 0) ? 1 : -1;
+                    break;
                 }
-            }
-        }
-        ancestors[depth] = NULL;
-        if (score == lose_score && !is_check_i) // stalemate
-            score = 0;
-        into_ttable(hash, score, total_depth);
-        return score;
-    }
-
-    void root_eval(Tag &tag, short &best_sq_i, short &best_sq_f)
-    {
-        ancestors[0] = glob_hash;
-
-        bool is_check_i = is_check(glob_player), is_PV_node = true;
-        short child_score = NULL, win_score = lose_score_score(!glob_player, 0), score = lose_score_score(glob_player, 0);
-        unsigned long long child_hash = NULL;
-        CastleRight child_castle_rights;
-        Moves *m = nullptr;
-        MVVLVAMoveGenerator moves(*this, glob_player, false, glob_castle_rights.data()[glob_player]);
-        std::clog << "Possible {move, score}:" << std::endl;
-        while ((m = moves.next()) && score != win_score)
-        {
-            if ( will_check(glob_player, m->sq_i, m->sq_f, m->ptr_v) ||
-                (m->tag == IS_CASTLE && !is_legal_castle(is_check_i, glob_player, m->sq_i, m->sq_f)) )
-                continue;
 
-            child_castle_rights = glob_castle_rights;
-            child_hash = move(glob_hash, glob_player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v, child_castle_rights.data());
-            child_score = eval(child_hash, !glob_player, 1, SHRT_MIN, SHRT_MAX, false, is_PV_node, child_castle_rights);
-            is_PV_node = false;
-            unmove(glob_player, m->tag, m->shape, m->sq_i, m->sq_f, m->ptr_v);
-
-            std::clog << "{" << LAN_of(m->tag, m->sq_i, m->sq_f) << ", " << child_score << "}," << std::endl;
-            if (glob_player == MAXER && child_score >= score)
-            {
-                tag = m->tag;
-                best_sq_i = m->sq_i;
-                best_sq_f = m->sq_f;
-                score = child_score;
+                if (!engine->is_check(engine->glob_player) && tag == IS_NORM && !engine->squares[sq_f] && std::abs(score) < DATAGEN_WIN_SCORE)
+                    records.push_back(record_of(*engine, score, ply));
+                engine->play(tag, sq_i, sq_f);
             }
-            else if (glob_player == MINER && child_score <= score)
+            for (DataRecord &record : records)
+                record.result = result;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t write_cnt = std::min(records.size(), size_t(std::max(position_cnt - written_cnt, 0LL)));
+            out.write(reinterpret_cast<const char *>(records.data()), write_cnt * sizeof(DataRecord));
+            written_cnt += write_cnt;
+            if (++done_cnt % DATAGEN_REPORT_INTERVAL == 0 || (write_cnt && written_cnt >= position_cnt))
             {
-                tag = m->tag;
-                best_sq_i = m->sq_i;
-                best_sq_f = m->sq_f;
-                score = child_score;
+                long long ms = std::max(now_ms() - start, 1LL);
+                std::lock_guard<std::mutex> io_lock(io_mutex);
+                std::cout << "Games " << done_cnt << ", positions " << written_cnt << '/' << position_cnt
+                    << ", positions/hour " << written_cnt * 3600000 / ms << '\n' << std::flush;
             }
         }
-        root_depth += 2; // 1 for human, 1 for bot
-    }
+    };
 
-    /**
-     * @return whether move is valid.
-     * 0: valid
-     * 1: illegal move vector
-     * 2: outside play area
-     * 3: empty initial square
-     * 4: impersonating bot
-     * 5: illegal capture
-     * 6: blocked path
-     * 7: illegal promotion
-     * 8: is in check before/on the path of castling
-     * 9: is in check after move
-     */
-    short validate(Tag tag, short sq_i, short sq_f)
-    {
-        if (!is_play_area(sq_i) || !is_play_area(sq_f))
-            return 2;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < options.thread_cnt; i++)
+        threads.emplace_back(work);
+    for (std::thread &thread : threads)
+        thread.join();
 
-        Piece *ptr_a = squares[sq_i],
-              *ptr_v = squares[sq_f];
-        if (!ptr_a)
-            return 3;
+    out.close();
+    LOG(LOG_INFO, "datagen: " << written_cnt << " positions of " << done_cnt << " games written to " << path);
+    logger.flush();
+}
 
-        else if (ptr_a->player != glob_player)
-            return 4;
+const size_t PGN_CHUNK = 1 << 20; // bytes of a PGN taken by a thread at once, whose games are the ones starting in them
 
-        else if (ptr_v && (ptr_v->player == glob_player || ptr_v->shape == KING))
-            return 5;
+/**
+ * @return offset of the first game of text at or after at, a line starting with "[Event ", text.size() if none.
+ */
+size_t next_game_of(std::string_view text, size_t at)
+{
+    for (size_t p = text.find("[Event ", at); p != std::string_view::npos; p = text.find("[Event ", p + 1))
+        if (p == 0 || text[p - 1] == '\n')
+            return p;
+    return text.size();
+}
 
-        short y_i = y_of(sq_i),
-              y_f = y_of(sq_f),
-              dx = abs(x_of(sq_f) - x_of(sq_i)),
-              dy = abs(y_f - y_i),
-              d_cheby = std::max(dx, dy);
-        
-        bool is_promo = tag <= IS_PROMO_Q;
-        Shape shape = ptr_a->shape;
-        if (shape == PAWN)
+/**
+ * Replay game, the tag pairs and movetext of 1 PGN game, on engine from its FEN tag or the initial position.
+ * Every position from ply min_ply to max_ply is appended to records with the result of the Result tag, and its glob_hash to hashes.
+ * Comments, variations, NAGs and move numbers are skipped, and games without a result ("*") are not replayed.
+ * @return false if a move could not be played: illegal, en passant or underpromotion (not played by Engine), positions before it are kept.
+ */
+bool replay_PGN(std::string_view game, Engine &engine, short min_ply, short max_ply, std::vector<DataRecord> &records, std::vector<unsigned long long> &hashes)
+{
+    std::string_view FEN = DEFAULT_FEN, result = "*";
+    size_t i = 0;
+    while ((i = game.find_first_not_of(" \t\r\n", i)) != std::string_view::npos && game[i] == '[')
+    {
+        size_t end = std::min(game.find('\n', i), game.size()), quote_i = game.find('"', i), quote_f = game.rfind('"', end);
+        std::string_view name = game.substr(i + 1, game.find(' ', i) - i - 1);
+        if (quote_i < quote_f && quote_f < end)
         {
-            bool on_promo_row = (y_i == 1 && glob_player) || (y_i == 6 && !glob_player),
-                 on_start_row = (y_i == 1 && !glob_player) || (y_i == 6 && glob_player);
-
-            if (rel_forward(glob_player)*(y_f - y_i) < 0) // backward
-                return 1;
-
-            else if (!is_promo && on_promo_row)
-                return 7;
-
-            else if (is_promo && !on_promo_row)
-                return 7;
-
-            else if (!ptr_v && dx)
-                return 1;
-            
-            else if (ptr_v && dx != 1)
-                return 5;
-            
-            else if (dy > 2 && on_start_row)
-                return 1;
-            
-            else if (dy > 1 && !on_start_row)
-                return 1;
+            if (name == "FEN")
+                FEN = game.substr(quote_i + 1, quote_f - quote_i - 1);
+            else if (name == "Result")
+                result = game.substr(quote_i + 1, quote_f - quote_i - 1);
         }
-        else if (is_promo)
-            return 9;
-
-        else if (shape == KNIGHT && (dx != 1 || dy != 2) && (dx != 2 || dy != 1))
-            return 1;
-
-        else if (shape == BISHOP && dx != dy)
-            return 1;
-
-        else if (shape == ROOK && dx && dy)
-            return 1;
+        i = end;
+    }
+    engine.clear();
+    if (result == "*" || !engine.load(FEN))
+        return true;
 
-        else if (shape == QUEEN && dx && dy && dx != dy)
-            return 1;
+    short ply = 0;
+    auto sample = [&]()
+    {
+        if (ply < min_ply)
+            return;
+        records.push_back(record_of(engine, 0, ply));
+        records.back().result = (result == "1-0") ? 1 : (result == "0-1") ? -1 : 0;
+        hashes.push_back(engine.glob_hash);
+    };
+    sample();
 
-        else if (shape == KING)
+    Moves m;
+    short variation_depth = 0;
+    while (i < game.size() && ply < max_ply)
+    {
+        char ch = game[i];
+        if (ch == '{' || ch == ';')
         {
-            if (tag == IS_CASTLE)
-            {
-                Side side = (sq_f < sq_i) ? Q_SIDE : K_SIDE;
-
-                if (!glob_castle_rights.data()[glob_player][side])
-                    return 8;
-
-                short rook_sq_i = R_SQ_CASTLE[glob_player][side];
-                if (!is_path_clear(sq_i, rook_sq_i, abs(sq_i - rook_sq_i)))
-                    return 8;
-            }
-            else if (d_cheby > 1)
-                return 1;
+            i = std::min(game.find(ch == '{' ? '}' : '\n', i), game.size()) + 1;
+            continue;
+        }
+        if (ch == '(' || ch == ')' || ch == '}' || isspace(ch))
+        {
+            variation_depth += (ch == '(') - (ch == ')');
+            i++;
+            continue;
         }
 
-        if (shape != KNIGHT && shape != KING && !is_path_clear(sq_i, sq_f, d_cheby))
-            return 6;
+        size_t end = std::min(game.find_first_of(" \t\r\n{};()", i), game.size());
+        std::string_view token = game.substr(i, end - i);
+        i = end;
+        if (variation_depth > 0 || token[0] == '$')
+            continue;
+        if (token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*")
+            break;
+        size_t move_at = token.find_first_not_of("0123456789");
+        if (move_at == std::string_view::npos) // move number
+            continue;
+        if (move_at && token[move_at] == '.') // move number prefix, not "0-0"
+        {
+            move_at = token.find_first_not_of('.', move_at);
+            if (move_at == std::string_view::npos)
+                continue;
+            token.remove_prefix(move_at);
+        }
 
-        if (will_check(glob_player, sq_i, sq_f, ptr_v))
-            return 9;
+        if (!engine.parse_SAN(token, m))
+            return false;
+        engine.play(m.tag, m.sq_i, m.sq_f);
+        ply++;
+        sample();
+    }
+    return true;
+}
 
-        // if all valid
-        return 0;
+/**
+ * Command line mode "pgn path [out path] [format fen|bin] [min_ply n] [max_ply n] [threads n]": write the distinct positions of the games of a PGN.
+ * The PGN is memory-mapped and taken by the threads in chunks of PGN_CHUNK bytes, each replaying the games starting in its chunk (see replay_PGN()).
+ * Positions are deduplicated by glob_hash, the first written being kept, and written in the order the chunks finish:
+ * format fen (default): lines "FEN [result]" as read by precalc/texel_tuner.cpp, to out or else stdout,
+ * format bin: DataRecords with score 0, appended to out (default: positions.bin), see misc/data_reader.cpp.
+ */
+void pgn(const std::string &cmd)
+{
+    const WorkerOptions options(cmd);
+    std::string_view rest = cmd;
+    next_token(rest); // "pgn"
+    std::string path = std::string(next_token(rest)), out_path = "", format = "fen", token = "";
+    short min_ply = 0, max_ply = SHRT_MAX;
+    std::istringstream tokens(cmd);
+    while (tokens >> token)
+    {
+        if (token == "out")
+            tokens >> out_path;
+        else if (token == "format")
+            tokens >> format;
+        else if (token == "min_ply")
+            tokens >> min_ply;
+        else if (token == "max_ply")
+            tokens >> max_ply;
     }
+    const bool is_bin = (format == "bin");
 
-    /**
-     * @return
-     * mate_type = 0 if game continues
-     * mate_type = 1 if bot is checkmated
-     * mate_type = 2 if bot is stalemated
-     */
-    std::string mate_type()
+    MappedFile file;
+    if (!file.open(path))
     {
-        Moves *m = nullptr;
-        MVVLVAMoveGenerator moves(*this, glob_player, false, glob_castle_rights.data()[glob_player]);
-        while((m = moves.next()) && will_check(glob_player, m->sq_i, m->sq_f, m->ptr_v));
-        if (!m)
+        LOG(LOG_ERROR, "could not open " << path);
+        return;
+    }
+    std::ofstream out_file;
+    if (is_bin && !open_data(out_path.empty() ? "positions.bin" : out_path, out_file))
+        return;
+    if (!is_bin && !out_path.empty())
+    {
+        out_file.open(out_path);
+        if (!out_file)
         {
-            if (is_check(glob_player))
-                if (glob_player == BOT)
-                    return "You win!";
-                else
-                    return "You lost!";
-            else
-                return "Stalemate!";
+            LOG(LOG_ERROR, "could not open " << out_path);
+            return;
         }
-        return "";
     }
-};
+    std::ostream &out = (is_bin || !out_path.empty()) ? out_file : std::cout;
 
-void console_play()
-{
-    static Engine engine;
-    std::cout << "===========================================" << std::endl
-        << "            SIGMA4 UCI CHESSBOT" << std::endl
-        << "              by RandomKerbal" << std::endl
-        << "===========================================" << std::endl << std::endl
-        << "En passant is not supported!" << std::endl << std::endl
-        << "What is the UCI long algebraic notation (e.g. e2e4, g7g8q)?" << std::endl
-        << "https://en.wikipedia.org/wiki/Algebraic_notation_(chess)#Long_algebraic_notation" << std::endl << std::endl
-        << "Starter: " << (engine.glob_player ? "HUMAN" : "BOT") << std::endl << std::endl;
+    const std::string_view text(file.data, file.size);
+    std::mutex mutex;
+    std::unordered_set<unsigned long long> written_hashes;
+    long long game_cnt = 0, stopped_cnt = 0, position_cnt = 0;
+    std::atomic<size_t> next_chunk{0};
+    const long long start = now_ms();
 
-    std::string LAN = "";
-    Tag tag = IS_NORM;
-    short sq_i = NULL, sq_f = NULL, error_type = NULL;
-    while (engine.mate_type() == "")
+    auto work = [&]()
     {
-        if (engine.glob_player) // HUMAN
+        std::unique_ptr<Engine> engine = std::make_unique<Engine>(1);
+        std::vector<DataRecord> records;
+        std::vector<unsigned long long> hashes;
+        std::string lines = "";
+        for (size_t chunk = next_chunk++; chunk * PGN_CHUNK < text.size(); chunk = next_chunk++)
         {
-            std::cout << engine;
-            do
+            records.clear();
+            hashes.clear();
+            long long chunk_game_cnt = 0, chunk_stopped_cnt = 0;
+            size_t end = std::min((chunk + 1) * PGN_CHUNK, text.size());
+            for (size_t at = next_game_of(text, chunk * PGN_CHUNK), next = 0; at < end; at = next)
             {
-                std::cout << "Input UCI long algebraic notation: ";
-                std::getline(std::cin, LAN);
-                engine.parse_LAN(LAN, tag, sq_i, sq_f);
-                error_type = engine.validate(tag, sq_i, sq_f);
-                if (error_type)
-                    std::cout << "Invalid move, broken rule #" << error_type << std::endl;
+                next = next_game_of(text, at + 1);
+                chunk_stopped_cnt += !replay_PGN(text.substr(at, next - at), *engine, min_ply, max_ply, records, hashes);
+                chunk_game_cnt++;
             }
-            while (error_type);
-            engine.glob_hash = engine.move(engine.glob_hash, engine.glob_player, tag, engine.squares[sq_i]->shape, sq_i, sq_f, engine.squares[sq_f], engine.glob_castle_rights.data());
-            engine.glob_player = !engine.glob_player;
-            std::cout << engine.mate_type() << std::endl;
-        }
-        else // BOT
-        {
-            engine.root_eval(tag, sq_i, sq_f);
-            engine.glob_hash = engine.move(engine.glob_hash, engine.glob_player, tag, engine.squares[sq_i]->shape, sq_i, sq_f, engine.squares[sq_f], engine.glob_castle_rights.data());
-            engine.glob_player = !engine.glob_player;
-            std::cout << std::endl << "Chosen: " << LAN_of(tag, sq_i, sq_f) << std::endl << legal << ' ' << illegal
-            << engine.mate_type() << std::endl;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            lines.clear();
+            for (size_t i = 0; i < records.size(); i++)
+            {
+                if (!written_hashes.insert(hashes[i]).second)
+                    continue;
+                if (is_bin)
+                    out.write(reinterpret_cast<const char *>(&records[i]), sizeof(DataRecord));
+                else
+                    lines += FEN_of(records[i]) + (records[i].result > 0 ? " [1.0]\n" : records[i].result < 0 ? " [0.0]\n" : " [0.5]\n");
+            }
+            if (!is_bin)
+            {
+                std::lock_guard<std::mutex> io_lock(io_mutex);
+                out << lines;
+            }
+            game_cnt += chunk_game_cnt;
+            stopped_cnt += chunk_stopped_cnt;
+            position_cnt += records.size();
         }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < options.thread_cnt; i++)
+        threads.emplace_back(work);
+    for (std::thread &thread : threads)
+        thread.join();
+
+    out << std::flush;
+    long long ms = std::max(now_ms() - start, 1LL);
+    LOG(LOG_INFO, "pgn: " << game_cnt << " games (" << stopped_cnt << " stopped at a move not played by the engine), "
+        << written_hashes.size() << " distinct of " << position_cnt << " positions in " << ms << " ms, " << position_cnt * 1000 / ms << " positions/s");
+    logger.flush();
+}
+
+/**
+ * Body of the search thread started by "go".
+ * A book move is played without searching, except for "go infinite" (analysis).
+ * bestmove is held back until "stop" or "ponderhit" if the search was "go infinite" or "go ponder".
+ */
+void uci_search(Engine &engine)
+{
+    Tag tag = IS_NORM;
+    short sq_i = -1, sq_f = -1;
+    if (!engine.limits.infinite && engine.book_move(tag, sq_i, sq_f))
+    {
+        std::lock_guard<std::mutex> lock(io_mutex);
+        std::cout << "info string book move " << LAN_of(tag, sq_i, sq_f) << '\n';
     }
-    std::cout << engine;
+    else
+    {
+        if (!engine.tree.path.empty() && !engine.tree.open())
+            LOG(LOG_ERROR, "could not open " << engine.tree.path);
+        engine.root_eval(tag, sq_i, sq_f);
+        engine.tree.close();
+    }
+    {
+        TraceScope trace_wait("wait_for_stop");
+        while (!engine.stop && (engine.is_pondering || engine.limits.infinite))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (tracer.is_enabled)
+        tracer.dump();
+
+    std::lock_guard<std::mutex> lock(io_mutex);
+    if (sq_i < 0) // no legal move
+        std::cout << "bestmove 0000" << '\n';
+    else
+    {
+        std::cout << "bestmove " << LAN_of(tag, sq_i, sq_f);
+        if (engine.best_line_len >= 2)
+            std::cout << " ponder " << LAN_of(engine.best_line[1].tag, engine.best_line[1].sq_i, engine.best_line[1].sq_f);
+        std::cout << '\n';
+    }
+    std::cout << std::flush; // the GUI waits for bestmove
+    logger.flush();
 }
 
 void uci_play()
 {
     static Engine engine;
-    std::cout << "id name SIGMA4" << std::endl
-        << "id author RandomKerbal" << std::endl
-        << "uciok" << std::endl;
-
-    std::string cmd= "", LAN = "";
+    std::cout << "id name SIGMA4" << '\n'
+        << "id author RandomKerbal" << '\n'
+        << "option name MultiPV type spin default 1 min 1 max " << MAX_MULTI_PV << '\n'
+        << "option name TraceFile type string default <empty>" << '\n'
+        << "option name TreeFile type string default <empty>" << '\n'
+        << "option name OwnBook type check default false" << '\n'
+        << "option name BookFile type string default <empty>" << '\n'
+        << "option name LogLevel type combo default info var error var warn var info var debug" << '\n';
+    for (const Param &param : PARAMS)
+        std::cout << "option name " << param.name << " type spin default " << param.default_value << " min " << param.min << " max " << param.max << '\n';
+    std::cout << "uciok" << '\n' << std::flush;
+
+    std::string cmd= "",
+                position = ""; // last "position" command, whose moves are already played on engine
+    std::string_view rest, token;
     Tag tag = IS_NORM;
-    short sq_i = NULL, sq_f = NULL, i = NULL, ii = NULL;
-    const short FEN_FIELD_CNT = 6;
+    short sq_i = NULL, sq_f = NULL, i = NULL;
+
+    // the search runs on its own thread so that stop, ponderhit, isready and quit are answered mid-search
+    std::thread searcher;
+    auto stop_search = [&]()
+    {
+        engine.stop = true;
+        if (searcher.joinable())
+            searcher.join();
+    };
 
     while (cmd != "quit")
     {
         i = 0;
-        std::getline(std::cin, cmd);
+        if (!std::getline(std::cin, cmd))
+            break;
 
         if (cmd == "isready")
         {
-            std::cout << "readyok" << std::endl;
+            std::lock_guard<std::mutex> lock(io_mutex);
+            logger.flush();
+            std::cout << "readyok" << '\n' << std::flush;
         }
         else if (cmd == "ucinewgame")
         {
+            stop_search();
             engine.clear();
             engine.load();
+            position.clear();
         }
         else if (cmd.find("go") == i)
         {
-            engine.root_eval(tag, sq_i, sq_f);
-            std::cout << "bestmove " << LAN_of(tag, sq_i, sq_f) << std::endl;
+            stop_search();
+            engine.limits = parse_go(cmd);
+            engine.is_pondering = engine.limits.ponder;
+            engine.stop = false;
+            searcher = std::thread(uci_search, std::ref(engine));
         }
-        else if (cmd.find("position") == i)
-        {
-            i += sizeof("position"); // no need +1 due to null terminator
-            engine.clear();
+        else if (cmd == "stop")
+            stop_search();
 
-            if (cmd.find("fen") == i)
+        else if (cmd.find("setoption") == i)
+        {
+            stop_search();
+            std::string_view name, value;
+            parse_setoption(cmd, name, value);
+            short n = NULL;
+            if (name == "MultiPV" && std::from_chars(value.data(), value.data() + value.size(), n).ec == std::errc())
+                engine.multi_pv = std::max(short(1), std::min(n, MAX_MULTI_PV));
+            else if (name == "TraceFile")
             {
-                i += sizeof("fen");
-                ii = i;
-                for (short c = 0; c < FEN_FIELD_CNT; c++)
-                    ii = cmd.find(' ', ii + 1);
-
-                engine.load(cmd.substr(i, ii-i));
-                i = ii + 1;
+                tracer.path = (value == "<empty>") ? "" : std::string(value);
+                tracer.is_enabled = !tracer.path.empty();
             }
-            else if (cmd.find("startpos") == i)
+            else if (name == "TreeFile")
+                engine.tree.path = (value == "<empty>") ? "" : std::string(value);
+            else if (name == "OwnBook")
+                engine.book.is_enabled = (value == "true");
+            else if (name == "BookFile")
             {
-                i += sizeof("startpos");
-                engine.load();
+                engine.book.path = (value == "<empty>") ? "" : std::string(value);
+                engine.book.file.close();
+                if (!engine.book.path.empty() && !engine.book.open())
+                    LOG(LOG_ERROR, "could not open " << engine.book.path << " as a Polyglot book");
             }
-            else
-                continue;
+            else if (name == "LogLevel")
+            {
+                for (short level = 0; level < MAX_LOG_LEVEL; level++)
+                    if (value == LOG_LEVEL_NAMES[level])
+                        logger.level = level;
+            }
+            else if (const Param *param = param_of(name); param && std::from_chars(value.data(), value.data() + value.size(), n).ec == std::errc())
+                engine.params.*param->value = std::max(param->min, std::min(n, param->max));
+        }
+
+        else if (cmd == "ponderhit")
+        {
+            engine.clock_start = now_ms(); // the engine's own clock starts now
+            engine.is_pondering = false;
+        }
+        else if (cmd.find("position") == i)
+        {
+            stop_search();
+            rest = cmd;
 
-            if (cmd.find("moves") == i)
+            // if the GUI only appended moves to the last position, play just the new ones
+            if (!position.empty() && rest.substr(0, position.size()) == position &&
+                (rest.size() == position.size() || rest[position.size()] == ' '))
+                rest.remove_prefix(position.size());
+            else
             {
-                i += sizeof("moves");
-                do
+                next_token(rest); // "position"
+                token = next_token(rest);
+                engine.clear();
+
+                if (token == "fen")
+                {
+                    std::string_view FEN = rest.substr(0, rest.find(" moves"));
+                    rest.remove_prefix(FEN.size());
+                    if (!engine.load(FEN.substr(std::min(FEN.find_first_not_of(' '), FEN.size()))))
+                    {
+                        LOG(LOG_ERROR, "invalid FEN " << FEN << ", loading the initial position without the moves");
+                        engine.clear();
+                        engine.load();
+                        position.clear();
+                        continue; // the moves were meant for the rejected position
+                    }
+                }
+                else if (token == "startpos")
+                    engine.load();
+                else
                 {
-                    ii = cmd.find(' ', i);
-                    engine.parse_LAN((ii == std::string::npos) ? cmd.substr(i) : cmd.substr(i, ii-i), tag, sq_i, sq_f);
-                    engine.glob_hash = engine.move(engine.glob_hash, engine.glob_player, tag, engine.squares[sq_i]->shape, sq_i, sq_f, engine.squares[sq_f], engine.glob_castle_rights.data());
-                    engine.glob_player = !engine.glob_player;
-                    i = ii + 1;
-                } while (ii != std::string::npos);
+                    position.clear();
+                    continue;
+                }
             }
+
+            while (!(token = next_token(rest)).empty())
+            {
+                if (token == "moves")
+                    continue;
+                engine.parse_LAN(token, tag, sq_i, sq_f);
+                engine.play(tag, sq_i, sq_f);
+            }
+            position = cmd;
+        }
+        else if (cmd.find("perft") == i || cmd.find("divide") == i)
+        {
+            stop_search();
+            rest = cmd;
+            next_token(rest); // "perft" or "divide"
+            token = next_token(rest);
+            short depth = NULL;
+            if (token == "check")
+                perft_check();
+            else if (std::from_chars(token.data(), token.data() + token.size(), depth).ec == std::errc())
+                uci_perft(engine, depth, cmd[0] == 'd');
+        }
+        else if (cmd.find("bench") == i)
+        {
+            stop_search();
+            bench(cmd);
+        }
+        else if (cmd.find("epd ") == i)
+        {
+            stop_search();
+            epd(cmd);
+        }
+        else if (cmd == "stats") // UCI extension: counters of the last search
+        {
+            stop_search();
+#ifdef SEARCH_STATS
+            engine.stats.print(std::cout, engine.nodes);
+#else
+            std::cout << "info string search statistics are not compiled in, build with SEARCH_STATS defined" << '\n';
+#endif
         }
         else if (cmd == "d")
-            std::cout << engine << std::endl;
+        {
+            stop_search();
+            std::cout << engine << '\n';
+        }
     }
+    stop_search();
 }
 
-int main()
+#ifndef NO_MAIN // defined by tools that include this file, e.g. misc/micro_bench.cpp
+int main(int argc, char *argv[])
 {
     std::string cmd = "";
+    std::string mode = (argc > 1) ? argv[1] : "";
+    if (mode == "perft" && argc > 2 && std::string(argv[2]) == "check") // "chess_engine perft check", exits with 1 on a mismatch
+    {
+        bool is_passed = perft_check();
+        logger.flush();
+        return is_passed ? 0 : 1;
+    }
+    if (mode == "bench" || mode == "epd" || mode == "batch" || mode == "match" || mode == "spsa" || mode == "datagen" || mode == "pgn") // e.g. "chess_engine bench depth 7", "chess_engine epd wac.epd movetime 500"
+    {
+        for (int i = 1; i < argc; i++)
+            cmd += std::string(i > 1 ? " " : "") + argv[i];
+        if (mode == "bench")
+            bench(cmd);
+        else if (mode == "epd")
+            epd(cmd);
+        else if (mode == "batch")
+            batch(cmd);
+        else if (mode == "match")
+            match(cmd);
+        else if (mode == "spsa")
+            spsa(cmd);
+        else if (mode == "datagen")
+            datagen(cmd);
+        else
+            pgn(cmd);
+        logger.flush();
+        return 0;
+    }
+
     std::getline(std::cin, cmd);
     if (cmd == "uci")
         uci_play();
     else
         console_play();
     
+    logger.flush();
     return 0;
 }
+#endif
@@ -0,0 +1,110 @@
+/**
+ * Reads training data written by "chess_engine datagen", see struct DataRecord.
+ *
+ * Usage:
+ * data_reader file summary              records, results, scores and plies
+ * data_reader file fen [n]              first n records (default all) as lines "FEN [result] score", result of white 1.0, 0.5 or 0.0,
+ *                                       which precalc/texel_tuner.cpp reads
+ */
+#define NO_MAIN
+#include "../chess_engine.cpp"
+
+#include <cstdlib>
+
+const size_t READ_CHUNK = 1 << 16; // records read at once
+
+/**
+ * Call on_record with every record of path, streamed in chunks of READ_CHUNK, until it returns false.
+ */
+bool read_data(const char *path, const std::function<bool(const DataRecord &record)> &on_record)
+{
+    std::ifstream in(path, std::ios::binary);
+    DataHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        !std::equal(DATA_MAGIC, DATA_MAGIC + 8, header.magic) || header.record_sz != sizeof(DataRecord))
+    {
+        std::cerr << "Error: " << path << " is not training data." << std::endl;
+        return false;
+    }
+    std::vector<DataRecord> records(READ_CHUNK);
+    while (in)
+    {
+        in.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(DataRecord));
+        size_t cnt = size_t(in.gcount()) / sizeof(DataRecord);
+        for (size_t i = 0; i < cnt; i++)
+            if (!on_record(records[i]))
+                return true;
+    }
+    return true;
+}
+
+bool summary(const char *path)
+{
+    size_t record_cnt = 0, result_cnts[3] = {0, 0, 0}, white_cnt = 0;
+    long long abs_score_sum = 0;
+    unsigned short max_ply = 0;
+    const short SCORE_BUCKET = 100;
+    std::vector<size_t> score_cnts(2 * DATAGEN_WIN_SCORE / SCORE_BUCKET + 1, 0);
+    if (!read_data(path, [&](const DataRecord &record)
+    {
+        record_cnt++;
+        result_cnts[record.result + 1]++;
+        white_cnt += bool(record.flags & PACKED_WHITE_TO_MOVE);
+        abs_score_sum += std::abs(record.score);
+        max_ply = std::max(max_ply, record.ply);
+        size_t bucket = size_t(std::max(0, std::min(record.score + DATAGEN_WIN_SCORE, 2 * DATAGEN_WIN_SCORE)) / SCORE_BUCKET);
+        score_cnts[bucket]++;
+        return true;
+    }))
+        return false;
+
+    std::cout << "records " << record_cnt << std::endl
+        << "results of white: win " << result_cnts[2] << " draw " << result_cnts[1] << " loss " << result_cnts[0] << std::endl
+        << "white to move " << white_cnt << std::endl
+        << "mean |score| " << (record_cnt ? double(abs_score_sum) / record_cnt : 0) << ", max ply " << max_ply << std::endl;
+    for (size_t i = 0; i < score_cnts.size(); i++)
+        if (score_cnts[i])
+            std::cout << "  score " << std::setw(6) << short(i) * SCORE_BUCKET - DATAGEN_WIN_SCORE << std::setw(12) << score_cnts[i] << std::endl;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: data_reader file summary | fen [n]" << std::endl;
+        return 1;
+    }
+
+    std::string query = argv[2];
+    if (query == "summary")
+    {
+        if (!summary(argv[1]))
+            return 1;
+    }
+    else if (query == "fen")
+    {
+        unsigned long long n = (argc > 3) ? std::strtoull(argv[3], nullptr, 10) : ULLONG_MAX;
+        std::string out = "";
+        if (!read_data(argv[1], [&](const DataRecord &record)
+        {
+            if (!n)
+                return false;
+            n--;
+            out = FEN_of(record);
+            out += (record.result > 0) ? " [1.0] " : (record.result < 0) ? " [0.0] " : " [0.5] ";
+            out += std::to_string(record.score);
+            out += '\n';
+            std::cout << out;
+            return true;
+        }))
+            return 1;
+        std::cout << std::flush;
+    }
+    else
+    {
+        std::cerr << "Unknown query " << query << std::endl;
+        return 1;
+    }
+    return 0;
+}
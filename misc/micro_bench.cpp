@@ -0,0 +1,215 @@
+/**
+ * Microbenchmarks of the hot primitives of chess_engine.cpp, timed in isolation over a corpus of positions:
+ * BENCH_FENS and every position one legal move after them.
+ *
+ * Usage: micro_bench [samples] [warmup]
+ * Every primitive is run over the whole corpus warmup times untimed, then samples times timed.
+ * ns per call of each timed run are summarized as min, percentiles and mean in JSON on stdout.
+ */
+#define NO_MAIN
+#include "../chess_engine.cpp"
+
+#include <cstdlib>
+
+struct CorpusEntry
+{
+    std::unique_ptr<Engine> engine;
+    std::vector<Moves> moves; // legal moves, pointing into engine->pieces[]
+};
+
+struct Primitive
+{
+    const char *name;
+    unsigned long long (*run)(std::vector<CorpusEntry> &corpus, Engine &tt_engine, unsigned long long &sink); // @return number of calls
+};
+
+std::vector<unsigned long long> tt_hashes; // hashes of the corpus positions (BENCH_FENS and the positions 1 move after them), for into_ttable
+
+std::vector<Moves> legal_moves(Engine &engine)
+{
+    std::vector<Moves> legal;
+    bool is_check_i = engine.is_check(engine.glob_player);
+    Moves *m = nullptr;
+    Engine::MVVLVAMoveGenerator moves(engine, engine.glob_player, false, engine.glob_castle_rights.data()[engine.glob_player]);
+    while ((m = moves.next()))
+        if (!( engine.will_check(engine.glob_player, m->sq_i, m->sq_f, m->ptr_v) ||
+              (m->tag == IS_CASTLE && !engine.is_legal_castle(is_check_i, engine.glob_player, m->sq_i, m->sq_f)) ))
+            legal.push_back(*m);
+    return legal;
+}
+
+void load_corpus(std::vector<CorpusEntry> &corpus)
+{
+    std::vector<std::string> FENs;
+    std::unique_ptr<Engine> parent = std::make_unique<Engine>(1);
+    for (const std::string &FEN : BENCH_FENS)
+    {
+        parent->clear();
+        parent->load(FEN);
+        FENs.push_back(parent->FEN());
+        for (const Moves &m : legal_moves(*parent))
+        {
+            parent->play(m.tag, m.sq_i, m.sq_f);
+            FENs.push_back(parent->FEN());
+            parent->clear();
+            parent->load(FEN);
+        }
+    }
+
+    for (const std::string &FEN : FENs)
+    {
+        CorpusEntry entry;
+        entry.engine = std::make_unique<Engine>(1); // primitives other than into_ttable never touch the transposition table
+        entry.engine->clear();
+        entry.engine->load(FEN);
+        entry.moves = legal_moves(*entry.engine);
+        tt_hashes.push_back(entry.engine->glob_hash);
+        corpus.push_back(std::move(entry));
+    }
+}
+
+unsigned long long run_move_unmove(std::vector<CorpusEntry> &corpus, Engine &, unsigned long long &sink)
+{
+    unsigned long long cnt = 0;
+    CastleRight castle_rights;
+    for (CorpusEntry &entry : corpus)
+    {
+        Engine &engine = *entry.engine;
+        for (const Moves &m : entry.moves)
+        {
+            castle_rights = engine.glob_castle_rights;
+            sink += engine.move(engine.glob_hash, engine.glob_player, m.tag, m.shape, m.sq_i, m.sq_f, m.ptr_v, castle_rights.data());
+            engine.unmove(engine.glob_player, m.tag, m.shape, m.sq_i, m.sq_f, m.ptr_v);
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+unsigned long long run_gen_construct(std::vector<CorpusEntry> &corpus, Engine &, unsigned long long &sink)
+{
+    for (CorpusEntry &entry : corpus)
+    {
+        Engine &engine = *entry.engine;
+        Engine::MVVLVAMoveGenerator moves(engine, engine.glob_player, false, engine.glob_castle_rights.data()[engine.glob_player]);
+        sink += bool(moves.next()); // keeps the generated moves observable
+    }
+    return corpus.size();
+}
+
+unsigned long long run_gen_next(std::vector<CorpusEntry> &corpus, Engine &, unsigned long long &sink)
+{
+    Moves *m = nullptr;
+    for (CorpusEntry &entry : corpus)
+    {
+        Engine &engine = *entry.engine;
+        Engine::MVVLVAMoveGenerator moves(engine, engine.glob_player, false, engine.glob_castle_rights.data()[engine.glob_player]);
+        while ((m = moves.next()))
+            sink += m->sq_f;
+    }
+    return corpus.size();
+}
+
+unsigned long long run_is_check(std::vector<CorpusEntry> &corpus, Engine &, unsigned long long &sink)
+{
+    for (CorpusEntry &entry : corpus)
+        sink += entry.engine->is_check(entry.engine->glob_player);
+    return corpus.size();
+}
+
+unsigned long long run_will_check(std::vector<CorpusEntry> &corpus, Engine &, unsigned long long &sink)
+{
+    unsigned long long cnt = 0;
+    for (CorpusEntry &entry : corpus)
+    {
+        Engine &engine = *entry.engine;
+        for (const Moves &m : entry.moves)
+        {
+            sink += engine.will_check(engine.glob_player, m.sq_i, m.sq_f, m.ptr_v);
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+unsigned long long run_static_eval(std::vector<CorpusEntry> &corpus, Engine &, unsigned long long &sink)
+{
+    for (CorpusEntry &entry : corpus)
+        sink += entry.engine->static_eval();
+    return corpus.size();
+}
+
+unsigned long long run_into_ttable(std::vector<CorpusEntry> &, Engine &tt_engine, unsigned long long &sink)
+{
+    short draft = 0;
+    for (unsigned long long hash : tt_hashes)
+        tt_engine.into_ttable(hash, short(hash), draft++ & 7);
+    sink += tt_engine.ttable[tt_hashes.back() & (tt_engine.ttable.size() - 1)].score;
+    return tt_hashes.size();
+}
+
+const Primitive PRIMITIVES[] = {
+    {"move_unmove", run_move_unmove},
+    {"gen_construct", run_gen_construct},
+    {"gen_next", run_gen_next},
+    {"is_check", run_is_check},
+    {"will_check", run_will_check},
+    {"static_eval", run_static_eval},
+    {"into_ttable", run_into_ttable},
+};
+
+/**
+ * @return p-th percentile of sorted, by nearest rank.
+ */
+double percentile(const std::vector<double> &sorted, double p)
+{
+    size_t i = size_t(p / 100 * sorted.size());
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+int main(int argc, char *argv[])
+{
+    int samples = (argc > 1) ? std::max(1, atoi(argv[1])) : 200,
+        warmup = (argc > 2) ? std::max(0, atoi(argv[2])) : 20;
+
+    std::vector<CorpusEntry> corpus;
+    load_corpus(corpus);
+    std::unique_ptr<Engine> tt_engine = std::make_unique<Engine>();
+
+    unsigned long long sink = 0, calls = 0;
+    std::cout << std::fixed << std::setprecision(2)
+        << "{" << std::endl
+        << "  \"positions\": " << corpus.size() << "," << std::endl
+        << "  \"samples\": " << samples << "," << std::endl
+        << "  \"warmup\": " << warmup << "," << std::endl
+        << "  \"primitives\": [" << std::endl;
+    for (const Primitive &primitive : PRIMITIVES)
+    {
+        for (int i = 0; i < warmup; i++)
+            primitive.run(corpus, *tt_engine, sink);
+
+        std::vector<double> ns_per_call;
+        double sum = 0;
+        for (int i = 0; i < samples; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            calls = primitive.run(corpus, *tt_engine, sink);
+            auto end = std::chrono::steady_clock::now();
+            ns_per_call.push_back(std::chrono::duration<double, std::nano>(end - start).count() / calls);
+            sum += ns_per_call.back();
+        }
+        std::sort(ns_per_call.begin(), ns_per_call.end());
+
+        std::cout << "    {\"name\": \"" << primitive.name << "\", \"calls\": " << calls
+            << ", \"ns_per_call\": {\"min\": " << ns_per_call.front()
+            << ", \"p50\": " << percentile(ns_per_call, 50)
+            << ", \"p90\": " << percentile(ns_per_call, 90)
+            << ", \"p99\": " << percentile(ns_per_call, 99)
+            << ", \"mean\": " << sum / samples << "}}"
+            << (&primitive == &PRIMITIVES[std::size(PRIMITIVES) - 1] ? "" : ",") << std::endl;
+    }
+    std::cout << "  ]," << std::endl
+        << "  \"sink\": " << sink << std::endl // printed so the compiler cannot drop the primitives' results
+        << "}" << std::endl;
+    return 0;
+}
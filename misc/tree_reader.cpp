@@ -0,0 +1,179 @@
+/**
+ * Queries a search tree dumped by chess_engine.cpp (UCI option TreeFile, or "bench tree path"), see struct TreeRecord.
+ *
+ * Usage:
+ * tree_reader file summary              records per reason and per ply of every iteration
+ * tree_reader file hash h               records of the position with hash h (decimal or 0x...)
+ * tree_reader file subtrees ply [n]     n largest subtrees rooted at ply (default 10)
+ * tree_reader file diff file2           records per iteration and ply of both files, to find where node counts grew
+ */
+#define NO_MAIN
+#include "../chess_engine.cpp"
+
+#include <cstdlib>
+#include <map>
+
+struct Subtree
+{
+    size_t first, last; // records[first...last], the root is records[last]
+    size_t size() const
+    {
+        return last - first + 1;
+    }
+};
+
+bool read_tree(const char *path, std::vector<TreeRecord> &records)
+{
+    std::ifstream in(path, std::ios::binary);
+    TreeHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        !std::equal(TREE_MAGIC, TREE_MAGIC + 8, header.magic) || header.record_sz != sizeof(TreeRecord))
+    {
+        std::cerr << "Error: " << path << " is not a search tree dump." << std::endl;
+        return false;
+    }
+    in.seekg(0, std::ios::end);
+    records.resize((size_t(in.tellg()) - sizeof(header)) / sizeof(TreeRecord));
+    in.seekg(sizeof(header));
+    in.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(TreeRecord));
+    return true;
+}
+
+void print_record(const TreeRecord &record)
+{
+    std::cout << "ply " << std::setw(2) << short(record.ply) << " draft " << std::setw(2) << short(record.draft)
+        << ' ' << std::left << std::setw(13) << TREE_REASON_NAMES[record.reason] << std::right
+        << " window [" << record.alpha << ", " << record.beta << "] score " << record.score
+        << " move " << (record.sq_i < 0 ? "-" : LAN_of(IS_NORM, record.sq_i, record.sq_f))
+        << " hash 0x" << std::hex << record.hash << std::dec << std::endl;
+}
+
+/**
+ * Records are written in post-order, so the subtree of a record is the run of records right before it with a greater ply.
+ */
+std::vector<Subtree> subtrees_of(const std::vector<TreeRecord> &records)
+{
+    std::vector<Subtree> subtrees(records.size()), pending; // pending: finished subtrees whose parent has not been written yet
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        size_t first = i;
+        while (!pending.empty() && records[pending.back().last].ply > records[i].ply)
+        {
+            first = pending.back().first;
+            pending.pop_back();
+        }
+        subtrees[i] = {first, i};
+        pending.push_back(subtrees[i]);
+    }
+    return subtrees;
+}
+
+/**
+ * @return records of each iteration, by ply.
+ */
+std::vector<std::map<short, size_t>> counts_of(const std::vector<TreeRecord> &records)
+{
+    std::vector<std::map<short, size_t>> counts(1);
+    for (const TreeRecord &record : records)
+    {
+        if (record.reason == TREE_ITERATION)
+            counts.emplace_back();
+        else
+            counts.back()[record.ply]++;
+    }
+    counts.pop_back(); // after the last iteration record
+    return counts;
+}
+
+void summary(const std::vector<TreeRecord> &records)
+{
+    size_t reason_cnts[MAX_TREE_REASON] = {0};
+    for (const TreeRecord &record : records)
+        reason_cnts[record.reason]++;
+
+    std::cout << "records " << records.size() << std::endl;
+    for (short reason = 0; reason < MAX_TREE_REASON; reason++)
+        std::cout << "  " << std::left << std::setw(13) << TREE_REASON_NAMES[reason] << std::right << std::setw(12) << reason_cnts[reason] << std::endl;
+
+    std::vector<std::map<short, size_t>> counts = counts_of(records);
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        std::cout << "iteration " << i + 1 << ':';
+        for (const auto &[ply, cnt] : counts[i])
+            std::cout << " ply " << ply << '=' << cnt;
+        std::cout << std::endl;
+    }
+}
+
+void diff(const std::vector<TreeRecord> &records_a, const std::vector<TreeRecord> &records_b)
+{
+    std::vector<std::map<short, size_t>> counts_a = counts_of(records_a), counts_b = counts_of(records_b);
+    std::cout << std::setw(10) << "iteration" << std::setw(5) << "ply" << std::setw(12) << "a" << std::setw(12) << "b" << std::setw(10) << "b/a" << std::endl;
+    for (size_t i = 0; i < std::max(counts_a.size(), counts_b.size()); i++)
+    {
+        std::map<short, std::pair<size_t, size_t>> plies;
+        if (i < counts_a.size())
+            for (const auto &[ply, cnt] : counts_a[i])
+                plies[ply].first = cnt;
+        if (i < counts_b.size())
+            for (const auto &[ply, cnt] : counts_b[i])
+                plies[ply].second = cnt;
+
+        for (const auto &[ply, cnts] : plies)
+        {
+            std::cout << std::setw(10) << i + 1 << std::setw(5) << ply << std::setw(12) << cnts.first << std::setw(12) << cnts.second
+                << std::setw(10) << std::fixed << std::setprecision(2) << (cnts.first ? double(cnts.second) / cnts.first : 0.0) << std::endl;
+            std::cout.unsetf(std::ios::fixed);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<TreeRecord> records;
+    if (argc < 3 || !read_tree(argv[1], records))
+    {
+        std::cerr << "Usage: tree_reader file summary | hash h | subtrees ply [n] | diff file2" << std::endl;
+        return 1;
+    }
+
+    std::string query = argv[2];
+    if (query == "summary")
+        summary(records);
+
+    else if (query == "hash" && argc > 3)
+    {
+        unsigned long long hash = std::strtoull(argv[3], nullptr, 0);
+        for (const TreeRecord &record : records)
+            if (record.hash == hash)
+                print_record(record);
+    }
+    else if (query == "subtrees" && argc > 3)
+    {
+        short ply = short(atoi(argv[3]));
+        size_t n = (argc > 4) ? size_t(atoi(argv[4])) : 10;
+        std::vector<Subtree> subtrees = subtrees_of(records), at_ply;
+        for (const Subtree &subtree : subtrees)
+            if (records[subtree.last].ply == ply)
+                at_ply.push_back(subtree);
+        std::sort(at_ply.begin(), at_ply.end(), [](const Subtree &a, const Subtree &b) { return a.size() > b.size(); });
+        for (size_t i = 0; i < std::min(n, at_ply.size()); i++)
+        {
+            std::cout << std::setw(10) << at_ply[i].size() << " records, record #" << at_ply[i].last << ": ";
+            print_record(records[at_ply[i].last]);
+        }
+    }
+    else if (query == "diff" && argc > 3)
+    {
+        std::vector<TreeRecord> records_b;
+        if (!read_tree(argv[3], records_b))
+            return 1;
+        diff(records, records_b);
+    }
+    else
+    {
+        std::cerr << "Unknown query " << query << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,301 @@
+/**
+ * Texel tuning of PST_OPENING/PST_ENDGAME of chess_engine.cpp against game results.
+ *
+ * Usage: texel_tuner dataset [epochs n] [rate r] [threads n] [out path]
+ * dataset: 1 position per line, a FEN followed by the result for white: 1-0, 0-1, 1/2-1/2, or [1.0], [0.5], [0.0] (e.g. c9 "1-0"; of EPD),
+ *          or a binary file of DataRecord written by "datagen" or "pgn ... format bin" of chess_engine.cpp.
+ *
+ * static_eval() is linear in the tables: sum over pieces of phase*opening + (1 - phase)*endgame, white minus black.
+ * Every position is loaded once into its phase and the (table entry, sign) of each piece, stored flat to be streamed by all threads.
+ * The loss is the mean squared error between result and sigmoid(K*eval), K first fitted to the initial tables.
+ * Every epoch computes the exact gradient over the whole dataset in parallel and takes an Adam step on white's tables,
+ * black's being white's mirrored, as in precalc_worths.cpp.
+ * The tables are written to out (default texel_worths.txt) in the format of precalc_worths.txt every 10 epochs and at the end.
+ */
+#define NO_MAIN
+#include "../chess_engine.cpp"
+
+#include <cstdlib>
+
+const short FEATURE_CNT = MAX_SHAPE * PLAY_WIDTH * PLAY_WIDTH; // entries of one table of one player
+const int TEXEL_EPOCHS = 200, TEXEL_SAVE_INTERVAL = 10, TEXEL_READ_RECORDS = 1 << 15; // records read at once of a binary dataset
+const double TEXEL_RATE = 1.0, // Adam step in centipawns
+             ADAM_BETA1 = 0.9, ADAM_BETA2 = 0.999, ADAM_EPSILON = 1e-8;
+
+/**
+ * Positions in structure-of-arrays layout: position i has features[begins[i]...begins[i+1]-1].
+ * A feature is 1 + table entry (shape*64 + square of white's table), negated for black's pieces.
+ */
+struct Dataset
+{
+    std::vector<float> phases, results; // phase: weight of opening, min(phase, MAX_PHASE)/MAX_PHASE
+    std::vector<size_t> begins = {0};
+    std::vector<short> features;
+
+    size_t size() const
+    {
+        return results.size();
+    }
+};
+
+inline short feature_of(Player player, Shape shape, short sq)
+{
+    short y = (player == HUMAN) ? y_of(sq) : PLAY_WIDTH-1 - y_of(sq); // black's table is white's mirrored
+    return 1 + shape*PLAY_WIDTH*PLAY_WIDTH + y*PLAY_WIDTH + x_of(sq);
+}
+
+/**
+ * @return result for white in line, -1 if none.
+ */
+float result_of(const std::string &line)
+{
+    if (line.find("1/2-1/2") != std::string::npos || line.find("[0.5]") != std::string::npos)
+        return 0.5;
+    if (line.find("1-0") != std::string::npos || line.find("[1.0]") != std::string::npos)
+        return 1;
+    if (line.find("0-1") != std::string::npos || line.find("[0.0]") != std::string::npos)
+        return 0;
+    return -1;
+}
+
+void add_position(const Engine &engine, float result, Dataset &dataset)
+{
+    for (short player = BOT; player <= HUMAN; player++)
+        for (const Piece &piece : engine.pieces[player])
+            if (piece.is_alive())
+                dataset.features.push_back((player == HUMAN ? 1 : -1) * feature_of(Player(player), piece.shape, piece.sq));
+    dataset.begins.push_back(dataset.features.size());
+    dataset.phases.push_back(float(std::min(engine.phase, MAX_PHASE)) / MAX_PHASE);
+    dataset.results.push_back(result);
+}
+
+/**
+ * Records of datagen are loaded as packed positions, skipping FEN parsing.
+ */
+bool load_dataset(const char *path, Dataset &dataset)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "Error: could not open " << path << std::endl;
+        return false;
+    }
+    std::unique_ptr<Engine> engine = std::make_unique<Engine>(1);
+    size_t skipped_cnt = 0;
+    DataHeader header;
+    if (in.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+        std::equal(DATA_MAGIC, DATA_MAGIC + 8, header.magic) && header.record_sz == sizeof(DataRecord))
+    {
+        std::vector<DataRecord> records(TEXEL_READ_RECORDS);
+        while (in.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(DataRecord)) || in.gcount() > 0)
+            for (size_t i = 0; i < size_t(in.gcount()) / sizeof(DataRecord); i++)
+            {
+                engine->clear();
+                engine->load(position_of(records[i]));
+                add_position(*engine, float(records[i].result + 1) / 2, dataset);
+            }
+    }
+    else
+    {
+        in.clear();
+        in.seekg(0);
+        std::string line = "";
+        while (std::getline(in, line))
+        {
+            float result = result_of(line);
+            std::string_view rest = line;
+            std::string FEN = "";
+            for (short i = 0; i < 4; i++)
+                FEN += std::string(next_token(rest)) + (i < 3 ? " " : " 0 1");
+            engine->clear();
+            if (result < 0 || !engine->load(FEN))
+            {
+                skipped_cnt++;
+                continue;
+            }
+            add_position(*engine, result, dataset);
+        }
+    }
+    std::cout << "Loaded " << dataset.size() << " positions, skipped " << skipped_cnt << " lines" << std::endl;
+    return dataset.size() > 0;
+}
+
+/**
+ * weights[0...FEATURE_CNT-1]: white's opening table, weights[FEATURE_CNT...]: white's endgame table, by feature - 1.
+ * @return loss of positions [begin, end), and adds its gradient (times the dataset size) to gradient if given.
+ */
+double loss_of(const Dataset &dataset, const std::vector<double> &weights, double K, size_t begin, size_t end, std::vector<double> *gradient)
+{
+    const double *opening = weights.data(), *endgame = weights.data() + FEATURE_CNT;
+    const double scale = K * std::log(10.0) / 400;
+    double loss = 0;
+    for (size_t i = begin; i < end; i++)
+    {
+        const short *feature = dataset.features.data() + dataset.begins[i], *feature_end = dataset.features.data() + dataset.begins[i + 1];
+        double phase = dataset.phases[i], eval_opening = 0, eval_endgame = 0;
+        for (const short *f = feature; f < feature_end; f++)
+        {
+            double sign = (*f > 0) ? 1 : -1;
+            short j = short(std::abs(*f) - 1);
+            eval_opening += sign * opening[j];
+            eval_endgame += sign * endgame[j];
+        }
+        double eval = phase * eval_opening + (1 - phase) * eval_endgame,
+               sigmoid = 1 / (1 + std::exp(-scale * eval)),
+               error = dataset.results[i] - sigmoid;
+        loss += error * error;
+
+        if (gradient)
+        {
+            double d_eval = -2 * error * sigmoid * (1 - sigmoid) * scale;
+            for (const short *f = feature; f < feature_end; f++)
+            {
+                double sign = (*f > 0) ? 1 : -1;
+                short j = short(std::abs(*f) - 1);
+                (*gradient)[j] += d_eval * sign * phase;
+                (*gradient)[FEATURE_CNT + j] += d_eval * sign * (1 - phase);
+            }
+        }
+    }
+    return loss;
+}
+
+/**
+ * @return mean loss over the dataset, split between threads, and its gradient in gradient if given.
+ */
+double parallel_loss_of(const Dataset &dataset, const std::vector<double> &weights, double K, size_t thread_cnt, std::vector<double> *gradient)
+{
+    std::vector<double> losses(thread_cnt, 0);
+    std::vector<std::vector<double>> gradients(thread_cnt, std::vector<double>(gradient ? weights.size() : 0, 0));
+    std::vector<std::thread> threads;
+    size_t chunk = (dataset.size() + thread_cnt - 1) / thread_cnt;
+    for (size_t t = 0; t < thread_cnt; t++)
+        threads.emplace_back([&, t]()
+        {
+            size_t begin = std::min(t * chunk, dataset.size()), end = std::min(begin + chunk, dataset.size());
+            losses[t] = loss_of(dataset, weights, K, begin, end, gradient ? &gradients[t] : nullptr);
+        });
+    for (std::thread &thread : threads)
+        thread.join();
+
+    double loss = 0;
+    for (size_t t = 0; t < thread_cnt; t++)
+    {
+        loss += losses[t];
+        if (gradient)
+            for (size_t j = 0; j < weights.size(); j++)
+                (*gradient)[j] += gradients[t][j] / dataset.size();
+    }
+    return loss / dataset.size();
+}
+
+/**
+ * @return K minimizing the loss of the initial tables, by golden-section search.
+ */
+double fit_K(const Dataset &dataset, const std::vector<double> &weights, size_t thread_cnt)
+{
+    const double ratio = (std::sqrt(5.0) - 1) / 2;
+    double lo = 0.01, hi = 3;
+    for (short i = 0; i < 30; i++)
+    {
+        double a = hi - ratio * (hi - lo), b = lo + ratio * (hi - lo);
+        if (parallel_loss_of(dataset, weights, a, thread_cnt, nullptr) < parallel_loss_of(dataset, weights, b, thread_cnt, nullptr))
+            hi = b;
+        else
+            lo = a;
+    }
+    return (lo + hi) / 2;
+}
+
+void write_fout(std::ofstream &fout, const std::vector<double> &weights, bool is_endgame, const char *arr_name)
+{
+    fout << "const short " << arr_name << "[MAX_PLAYER][MAX_SHAPE][AREA] = {";
+    for (short player = BOT; player <= HUMAN; player++)
+    {
+        fout << "{";
+        for (short shape = PAWN; shape < MAX_SHAPE; shape++)
+        {
+            fout << "{";
+            for (short sq = 0; sq < AREA; sq++)
+            {
+                if (is_play_area(sq))
+                    fout << std::lround(weights[is_endgame * FEATURE_CNT + feature_of(Player(player), Shape(shape), sq) - 1]);
+                else
+                    fout << 0;
+                fout << ",";
+            }
+            fout << "},";
+        }
+        fout << "},";
+    }
+    fout << "};" << std::endl;
+}
+
+void save(const char *path, const std::vector<double> &weights)
+{
+    std::ofstream fout(path);
+    write_fout(fout, weights, false, "PST_OPENING");
+    write_fout(fout, weights, true, "PST_ENDGAME");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: texel_tuner dataset [epochs n] [rate r] [threads n] [out path]" << std::endl;
+        return 1;
+    }
+    int epochs = TEXEL_EPOCHS;
+    double rate = TEXEL_RATE;
+    size_t thread_cnt = std::max(1u, std::thread::hardware_concurrency());
+    const char *out_path = "texel_worths.txt";
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        std::string option = argv[i];
+        if (option == "epochs")
+            epochs = atoi(argv[i + 1]);
+        else if (option == "rate")
+            rate = atof(argv[i + 1]);
+        else if (option == "threads")
+            thread_cnt = std::max(1, atoi(argv[i + 1]));
+        else if (option == "out")
+            out_path = argv[i + 1];
+    }
+
+    Dataset dataset;
+    if (!load_dataset(argv[1], dataset))
+        return 1;
+
+    std::vector<double> weights(2 * FEATURE_CNT), gradient(weights.size()), m(weights.size(), 0), v(weights.size(), 0);
+    for (short shape = PAWN; shape < MAX_SHAPE; shape++)
+        for (short sq = 0; sq < AREA; sq++)
+            if (is_play_area(sq))
+            {
+                short j = feature_of(HUMAN, Shape(shape), sq) - 1;
+                weights[j] = PST_OPENING[HUMAN][shape][sq];
+                weights[FEATURE_CNT + j] = PST_ENDGAME[HUMAN][shape][sq];
+            }
+
+    double K = fit_K(dataset, weights, thread_cnt);
+    std::cout << "K " << K << ", initial loss " << parallel_loss_of(dataset, weights, K, thread_cnt, nullptr) << std::endl;
+
+    for (int epoch = 1; epoch <= epochs; epoch++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::fill(gradient.begin(), gradient.end(), 0);
+        double loss = parallel_loss_of(dataset, weights, K, thread_cnt, &gradient);
+        for (size_t j = 0; j < weights.size(); j++)
+        {
+            m[j] = ADAM_BETA1 * m[j] + (1 - ADAM_BETA1) * gradient[j];
+            v[j] = ADAM_BETA2 * v[j] + (1 - ADAM_BETA2) * gradient[j] * gradient[j];
+            double m_hat = m[j] / (1 - std::pow(ADAM_BETA1, epoch)), v_hat = v[j] / (1 - std::pow(ADAM_BETA2, epoch));
+            weights[j] -= rate * m_hat / (std::sqrt(v_hat) + ADAM_EPSILON);
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "epoch " << epoch << " loss " << std::setprecision(8) << loss << " (" << ms << " ms)" << std::endl;
+
+        if (epoch % TEXEL_SAVE_INTERVAL == 0 || epoch == epochs)
+            save(out_path, weights);
+    }
+    return 0;
+}